@@ -37,7 +37,7 @@ CREATE TYPE dna (
 -- Create K-mer type
 CREATE TYPE kmer;
 
-CREATE FUNCTION kmer_in(cstring)
+CREATE FUNCTION kmer_in(cstring, oid, integer)
     RETURNS kmer
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
@@ -47,7 +47,7 @@ CREATE FUNCTION kmer_out(kmer)
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
-CREATE FUNCTION kmer_recv(internal)
+CREATE FUNCTION kmer_recv(internal, oid, integer)
     RETURNS kmer
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
@@ -57,16 +57,40 @@ CREATE FUNCTION kmer_send(kmer)
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION kmer_typmod_in(cstring[])
+    RETURNS integer
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION kmer_typmod_out(integer)
+    RETURNS cstring
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+-- K-mers of up to 31 bases are a 2-bit packed 64-bit word passed by value
 CREATE TYPE kmer (
-    internallength = VARIABLE,
+    internallength = 8,
     input = kmer_in,
     output = kmer_out,
     receive = kmer_recv,
     send = kmer_send,
-    alignment = int4,
-    storage = extended
+    typmod_in = kmer_typmod_in,
+    typmod_out = kmer_typmod_out,
+    passedbyvalue,
+    alignment = double,
+    storage = plain
 );
 
+-- Length coercion for kmer(k) columns
+CREATE FUNCTION kmer(kmer, integer, boolean)
+    RETURNS kmer
+    AS 'MODULE_PATHNAME', 'kmer_enforce_typmod'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE CAST (kmer AS kmer)
+    WITH FUNCTION kmer(kmer, integer, boolean)
+    AS IMPLICIT;
+
 -- Create Quality K-mer type
 CREATE TYPE qkmer;
 
@@ -100,6 +124,73 @@ CREATE TYPE qkmer (
     storage = extended
 );
 
+-- Create MinHash sketch type
+CREATE TYPE dna_sketch;
+
+CREATE FUNCTION dna_sketch_in(cstring)
+    RETURNS dna_sketch
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_sketch_out(dna_sketch)
+    RETURNS cstring
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_sketch_recv(internal)
+    RETURNS dna_sketch
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_sketch_send(dna_sketch)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+-- Hashes are 64-bit, so the type needs double alignment
+CREATE TYPE dna_sketch (
+    internallength = VARIABLE,
+    input = dna_sketch_in,
+    output = dna_sketch_out,
+    receive = dna_sketch_recv,
+    send = dna_sketch_send,
+    alignment = double,
+    storage = extended
+);
+
+-- Create HyperLogLog type for distinct k-mer counts
+CREATE TYPE kmer_hll;
+
+CREATE FUNCTION kmer_hll_in(cstring)
+    RETURNS kmer_hll
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION kmer_hll_out(kmer_hll)
+    RETURNS cstring
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION kmer_hll_recv(internal)
+    RETURNS kmer_hll
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION kmer_hll_send(kmer_hll)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE kmer_hll (
+    internallength = VARIABLE,
+    input = kmer_hll_in,
+    output = kmer_hll_out,
+    receive = kmer_hll_recv,
+    send = kmer_hll_send,
+    alignment = int4,
+    storage = extended
+);
+
 -- DNA utility functions
 CREATE FUNCTION dna_length(dna)
     RETURNS integer
@@ -126,6 +217,17 @@ CREATE FUNCTION generate_kmers(dna, integer)
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION generate_kmers(dna, integer, canonical boolean)
+    RETURNS kmer[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION generate_kmers_srf(dna, k integer, step integer DEFAULT 1,
+    skip_ambiguous boolean DEFAULT false, canonical boolean DEFAULT false)
+    RETURNS SETOF kmer
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
 CREATE FUNCTION dna_gc_content(dna)
     RETURNS double precision
     AS 'MODULE_PATHNAME'
@@ -136,11 +238,58 @@ CREATE FUNCTION dna_count_nucleotide(dna, char)
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION dna_gc_content(dna, integer, integer)
+    RETURNS double precision
+    AS 'MODULE_PATHNAME', 'dna_gc_content_range'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_count_nucleotide(dna, char, integer, integer)
+    RETURNS integer
+    AS 'MODULE_PATHNAME', 'dna_count_nucleotide_range'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_composition(dna,
+    OUT a integer, OUT c integer, OUT g integer, OUT t integer,
+    OUT r integer, OUT y integer, OUT s integer, OUT w integer,
+    OUT k integer, OUT m integer, OUT b integer, OUT d integer,
+    OUT h integer, OUT v integer, OUT n integer, OUT gap integer,
+    OUT gc_content double precision)
+    RETURNS record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_substring(dna, integer, integer)
+    RETURNS dna
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
 CREATE FUNCTION dna_find_subsequence(dna, dna)
     RETURNS integer
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION dna_find_all(dna, dna)
+    RETURNS SETOF integer
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_match_any(dna, patterns dna[], both_strands boolean DEFAULT false,
+    OUT pattern integer, OUT "position" integer, OUT strand "char")
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_find_iupac(dna, dna)
+    RETURNS integer
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_find_approx(dna, dna, max_errors integer, mode text DEFAULT 'edit',
+    OUT "position" integer, OUT length integer, OUT distance integer)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
 CREATE FUNCTION dna_is_palindrome(dna)
     RETURNS boolean
     AS 'MODULE_PATHNAME'
@@ -151,11 +300,33 @@ CREATE FUNCTION dna_translate(dna, integer)
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION dna_translate(dna, integer, integer)
+    RETURNS text
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_translate_6frame(dna, genetic_code integer DEFAULT 1,
+    OUT frame integer, OUT protein text)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
 CREATE FUNCTION dna_sliding_gc(dna, integer)
     RETURNS double precision[]
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION dna_sliding_gc(dna, integer, integer)
+    RETURNS double precision[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_gc_windows(dna, window_size integer, step integer DEFAULT 1,
+    OUT "position" integer, OUT gc double precision, OUT gc_skew double precision)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
 CREATE FUNCTION dna_count(dna, text)
     RETURNS integer
     AS 'MODULE_PATHNAME'
@@ -192,6 +363,140 @@ CREATE FUNCTION qkmer_filter_quality(qkmer, integer)
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION qkmer_bin_quality(qkmer, text)
+    RETURNS qkmer
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+-- MinHash sketch functions
+CREATE FUNCTION dna_sketch(dna, k integer, s integer DEFAULT 1000)
+    RETURNS dna_sketch
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_sketch_union(dna_sketch, dna_sketch)
+    RETURNS dna_sketch
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_sketch_jaccard(dna_sketch, dna_sketch)
+    RETURNS double precision
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_sketch_containment(dna_sketch, dna_sketch)
+    RETURNS double precision
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_sketch_distance(dna_sketch, dna_sketch)
+    RETURNS double precision
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_sketch_agg_trans(internal, dna, integer, integer)
+    RETURNS internal
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION dna_sketch_agg_combine(internal, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION dna_sketch_agg_serialize(internal)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION dna_sketch_agg_deserialize(bytea, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION dna_sketch_agg_final(internal)
+    RETURNS dna_sketch
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+-- Sketch of all the sequences of a group; partial states merge in parallel plans
+CREATE AGGREGATE dna_sketch_agg(dna, integer, integer) (
+    sfunc = dna_sketch_agg_trans,
+    stype = internal,
+    finalfunc = dna_sketch_agg_final,
+    combinefunc = dna_sketch_agg_combine,
+    serialfunc = dna_sketch_agg_serialize,
+    deserialfunc = dna_sketch_agg_deserialize,
+    parallel = safe
+);
+
+-- HyperLogLog functions
+CREATE FUNCTION kmer_hll(dna, k integer, precision integer DEFAULT 12)
+    RETURNS kmer_hll
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION kmer_hll_union(kmer_hll, kmer_hll)
+    RETURNS kmer_hll
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION kmer_hll_cardinality(kmer_hll)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION kmer_hll_agg_trans(internal, dna, integer)
+    RETURNS internal
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION kmer_hll_agg_trans(internal, dna, integer, integer)
+    RETURNS internal
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION kmer_hll_agg_combine(internal, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION kmer_hll_agg_serialize(internal)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION kmer_hll_agg_deserialize(bytea, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION kmer_hll_agg_final(internal)
+    RETURNS kmer_hll
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+-- Distinct k-mers of a group, fed by the rolling hash; the precision defaults to 12
+CREATE AGGREGATE kmer_hll_agg(dna, integer) (
+    sfunc = kmer_hll_agg_trans,
+    stype = internal,
+    finalfunc = kmer_hll_agg_final,
+    combinefunc = kmer_hll_agg_combine,
+    serialfunc = kmer_hll_agg_serialize,
+    deserialfunc = kmer_hll_agg_deserialize,
+    parallel = safe
+);
+
+CREATE AGGREGATE kmer_hll_agg(dna, integer, integer) (
+    sfunc = kmer_hll_agg_trans,
+    stype = internal,
+    finalfunc = kmer_hll_agg_final,
+    combinefunc = kmer_hll_agg_combine,
+    serialfunc = kmer_hll_agg_serialize,
+    deserialfunc = kmer_hll_agg_deserialize,
+    parallel = safe
+);
+
 -- DNA comparison functions
 CREATE FUNCTION dna_eq(dna, dna)
     RETURNS boolean
@@ -238,16 +543,56 @@ CREATE FUNCTION dna_contained_by(dna, dna)
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION dna_iupac_match(dna, dna)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
 CREATE FUNCTION dna_overlap(dna, dna)
     RETURNS boolean
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION dna_overlap(dna, dna, integer)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
 CREATE FUNCTION dna_similarity(dna, dna)
     RETURNS double precision
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION dna_edit_distance(dna, dna)
+    RETURNS integer
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_edit_distance(dna, dna, integer)
+    RETURNS integer
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_within_distance(dna, dna, integer)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_align_score(query dna, target dna, match integer DEFAULT 2,
+    mismatch integer DEFAULT -3, gap_open integer DEFAULT 5, gap_extend integer DEFAULT 2)
+    RETURNS integer
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_align_local(query dna, target dna, match integer DEFAULT 2,
+    mismatch integer DEFAULT -3, gap_open integer DEFAULT 5, gap_extend integer DEFAULT 2,
+    with_cigar boolean DEFAULT false,
+    OUT score integer, OUT query_start integer, OUT query_end integer,
+    OUT target_start integer, OUT target_end integer, OUT cigar text)
+    RETURNS record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
 -- K-mer comparison functions
 CREATE FUNCTION kmer_eq(kmer, kmer)
     RETURNS boolean
@@ -259,6 +604,21 @@ CREATE FUNCTION kmer_ne(kmer, kmer)
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION kmer_canonical_eq(kmer, kmer)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION kmer_reverse_complement(kmer)
+    RETURNS kmer
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION kmer_canonical(kmer)
+    RETURNS kmer
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
 CREATE FUNCTION kmer_cmp(kmer, kmer)
     RETURNS integer
     AS 'MODULE_PATHNAME'
@@ -285,6 +645,16 @@ CREATE FUNCTION kmer_hash_extended(kmer, bigint)
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION kmer_canonical_hash(kmer)
+    RETURNS integer
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION kmer_canonical_hash_extended(kmer, bigint)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
 CREATE FUNCTION qkmer_hash(qkmer)
     RETURNS integer
     AS 'MODULE_PATHNAME'
@@ -296,7 +666,30 @@ CREATE FUNCTION qkmer_hash_extended(qkmer, bigint)
     LANGUAGE C IMMUTABLE STRICT;
 
 CREATE FUNCTION dna_kmer_hashes(dna, integer)
-    RETURNS integer[]
+    RETURNS bigint[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_kmer_hashes(dna, integer, canonical boolean)
+    RETURNS bigint[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_kmer_hashes_srf(dna, k integer, canonical boolean DEFAULT false,
+    OUT "position" integer, OUT hash bigint)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_minimizers(dna, k integer, w integer,
+    OUT "position" integer, OUT hash bigint, OUT strand "char")
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION dna_syncmers(dna, k integer, s integer,
+    OUT "position" integer, OUT hash bigint, OUT strand "char")
+    RETURNS SETOF record
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
@@ -351,6 +744,11 @@ CREATE FUNCTION kmer_btree_ge(kmer, kmer)
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION kmer_sortsupport(internal)
+    RETURNS void
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
 CREATE FUNCTION dna_in_range(dna, dna, dna, boolean, boolean)
     RETURNS boolean
     AS 'MODULE_PATHNAME'
@@ -465,6 +863,14 @@ CREATE OPERATOR <@ (
     join = contjoinsel
 );
 
+CREATE OPERATOR ~@ (
+    leftarg = dna,
+    rightarg = dna,
+    procedure = dna_iupac_match,
+    restrict = contsel,
+    join = contjoinsel
+);
+
 CREATE OPERATOR && (
     leftarg = dna,
     rightarg = dna,
@@ -544,6 +950,24 @@ CREATE OPERATOR >= (
     join = scalargejoinsel
 );
 
+CREATE OPERATOR =~ (
+    leftarg = kmer,
+    rightarg = kmer,
+    procedure = kmer_canonical_eq,
+    commutator = =~,
+    restrict = eqsel,
+    join = eqjoinsel,
+    hashes
+);
+
+-- Sketch operators
+CREATE OPERATOR <-> (
+    leftarg = dna_sketch,
+    rightarg = dna_sketch,
+    procedure = dna_sketch_distance,
+    commutator = <->
+);
+
 -- Operator classes for indexing
 CREATE OPERATOR CLASS dna_ops
     DEFAULT FOR TYPE dna USING btree AS
@@ -567,7 +991,8 @@ CREATE OPERATOR CLASS kmer_ops
         OPERATOR        3       =,
         OPERATOR        4       >=,
         OPERATOR        5       >,
-        FUNCTION        1       kmer_cmp(kmer, kmer);
+        FUNCTION        1       kmer_cmp(kmer, kmer),
+        FUNCTION        2       kmer_sortsupport(internal);
 
 CREATE OPERATOR CLASS kmer_hash_ops
     DEFAULT FOR TYPE kmer USING hash AS
@@ -575,6 +1000,13 @@ CREATE OPERATOR CLASS kmer_hash_ops
         FUNCTION        1       kmer_hash(kmer),
         FUNCTION        2       kmer_hash_extended(kmer, bigint);
 
+-- Strand-independent equality, for joins and GROUP BY on canonical k-mers
+CREATE OPERATOR CLASS kmer_canonical_hash_ops
+    FOR TYPE kmer USING hash AS
+        OPERATOR        1       =~,
+        FUNCTION        1       kmer_canonical_hash(kmer),
+        FUNCTION        2       kmer_canonical_hash_extended(kmer, bigint);
+
 /*
 CREATE OPERATOR CLASS kmer_spgist_ops
     DEFAULT FOR TYPE kmer USING spgist AS
@@ -3,7 +3,6 @@
 
 /* Forward declarations for static functions */
 static int dna_fastcmp(Datum x, Datum y, SortSupport ssup);
-static int kmer_fastcmp(Datum x, Datum y, SortSupport ssup);
 
 /*
  * B-tree support functions for DNA and K-mer types
@@ -82,8 +81,8 @@ PG_FUNCTION_INFO_V1(kmer_btree_cmp);
 Datum
 kmer_btree_cmp(PG_FUNCTION_ARGS)
 {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
+    kmer a = PG_GETARG_KMER(0);
+    kmer b = PG_GETARG_KMER(1);
     
     PG_RETURN_INT32(kmer_compare_internal(a, b));
 }
@@ -95,8 +94,8 @@ PG_FUNCTION_INFO_V1(kmer_btree_lt);
 Datum
 kmer_btree_lt(PG_FUNCTION_ARGS)
 {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
+    kmer a = PG_GETARG_KMER(0);
+    kmer b = PG_GETARG_KMER(1);
     
     PG_RETURN_BOOL(kmer_compare_internal(a, b) < 0);
 }
@@ -108,8 +107,8 @@ PG_FUNCTION_INFO_V1(kmer_btree_le);
 Datum
 kmer_btree_le(PG_FUNCTION_ARGS)
 {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
+    kmer a = PG_GETARG_KMER(0);
+    kmer b = PG_GETARG_KMER(1);
     
     PG_RETURN_BOOL(kmer_compare_internal(a, b) <= 0);
 }
@@ -121,8 +120,8 @@ PG_FUNCTION_INFO_V1(kmer_btree_gt);
 Datum
 kmer_btree_gt(PG_FUNCTION_ARGS)
 {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
+    kmer a = PG_GETARG_KMER(0);
+    kmer b = PG_GETARG_KMER(1);
     
     PG_RETURN_BOOL(kmer_compare_internal(a, b) > 0);
 }
@@ -134,8 +133,8 @@ PG_FUNCTION_INFO_V1(kmer_btree_ge);
 Datum
 kmer_btree_ge(PG_FUNCTION_ARGS)
 {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
+    kmer a = PG_GETARG_KMER(0);
+    kmer b = PG_GETARG_KMER(1);
     
     PG_RETURN_BOOL(kmer_compare_internal(a, b) >= 0);
 }
@@ -169,6 +168,9 @@ dna_fastcmp(Datum x, Datum y, SortSupport ssup)
 
 /*
  * K-mer sortsupport function for optimized sorting
+ *
+ * K-mers are unsigned words passed by value, so the core's unsigned Datum
+ * comparator applies and lets tuplesort use its specialized routines.
  */
 PG_FUNCTION_INFO_V1(kmer_sortsupport);
 Datum
@@ -176,24 +178,12 @@ kmer_sortsupport(PG_FUNCTION_ARGS)
 {
     SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
     
-    ssup->comparator = kmer_fastcmp;
+    ssup->comparator = ssup_datum_unsigned_cmp;
     ssup->ssup_extra = NULL;
     
     PG_RETURN_VOID();
 }
 
-/*
- * Fast comparison function for K-mer sorting
- */
-static int
-kmer_fastcmp(Datum x, Datum y, SortSupport ssup)
-{
-    kmer *a = DatumGetKmerP(x);
-    kmer *b = DatumGetKmerP(y);
-    
-    return kmer_compare_internal(a, b);
-}
-
 /*
  * DNA range query support functions
  */
@@ -12,41 +12,342 @@
 #include "catalog/pg_type.h"
 #include "iupac.h"
 
-/* DNA sequence type */
+/*
+ * DNA sequence type
+ *
+ * A sequence is stored either one byte per base (plain) or 2 bits per base
+ * (packed), whichever is smaller.  The packed payload is laid out as:
+ *
+ *     uint32  nruns                 number of ambiguity runs
+ *     DnaRun  runs[nruns]           runs of non-ACGT symbols, by position
+ *     uint8   bits[(length + 3)/4]  A/C/G/T codes, first base in high bits
+ *
+ * Sequences of at least DNA_SUMMARY_MIN_LENGTH bases also carry a
+ * DnaSummary in front of the plain bases or packed payload, so composition
+ * queries can be answered from a short prefix of the value.
+ *
+ * The choice depends only on the sequence content, so equal sequences always
+ * have byte-identical representations.
+ */
 typedef struct
 {
     int32 vl_len_;      /* Variable length header */
-    char data[FLEXIBLE_ARRAY_MEMBER]; /* DNA sequence data */
+    uint32 length;      /* Number of bases */
+    uint32 flags;       /* DNA_FLAG_* bits */
+    char data[FLEXIBLE_ARRAY_MEMBER]; /* Plain bases or packed payload */
 } dna;
 
-/* K-mer type */
+#define DNA_FLAG_PACKED         0x0001
+#define DNA_FLAG_SUMMARY        0x0002
+
+/* Symbols counted by a summary, in the order of DnaSummary.counts */
+#define DNA_SYMBOLS             "ACGTRYSWKMBDHVN-"
+#define DNA_NSYMBOLS            16
+#define DNA_SYMBOL_A            0
+#define DNA_SYMBOL_C            1
+#define DNA_SYMBOL_G            2
+#define DNA_SYMBOL_T            3
+#define DNA_SYMBOL_N            14
+#define DNA_SYMBOL_GAP          15
+
+/*
+ * Composition of a sequence, computed once when the value is built
+ *
+ * Stored only for long sequences: below DNA_SUMMARY_MIN_LENGTH bases a scan
+ * is cheap and the summary would add too much to the packed size.
+ */
+typedef struct
+{
+    uint32 counts[DNA_NSYMBOLS]; /* Occurrences of each of DNA_SYMBOLS */
+    uint32 flags;       /* DNA_SUMMARY_* bits */
+} DnaSummary;
+
+#define DNA_SUMMARY_MIN_LENGTH  2048
+
+#define DNA_SUMMARY_ONLY_ACGT   0x0001  /* No ambiguity codes or gaps */
+#define DNA_SUMMARY_PALINDROME  0x0002  /* Same as dna_is_palindrome() */
+#define DNA_SUMMARY_CANONICAL   0x0004  /* Not greater than its reverse complement */
+
+/* Run of a single ambiguity code or gap inside a packed sequence */
+typedef struct
+{
+    uint32 start;       /* Position of the first base of the run */
+    uint32 len;         /* Number of bases in the run */
+    char code;          /* IUPAC ambiguity code or gap */
+} DnaRun;
+
+#define DNA_HDRSZ               offsetof(dna, data)
+#define DNA_IS_PACKED(d)        (((d)->flags & DNA_FLAG_PACKED) != 0)
+#define DNA_HAS_SUMMARY(d)      (((d)->flags & DNA_FLAG_SUMMARY) != 0)
+#define DNA_SUMMARY(d)          ((const DnaSummary *) (d)->data)
+/* Offset of the plain bases or packed payload from the data member */
+#define DNA_BODY_OFFSET(flags)  (((flags) & DNA_FLAG_SUMMARY) ? sizeof(DnaSummary) : 0)
+#define DNA_BODY(d)             ((d)->data + DNA_BODY_OFFSET((d)->flags))
+#define DNA_NRUNS(d)            (*(const uint32 *) DNA_BODY(d))
+#define DNA_RUNS(d)             ((const DnaRun *) (DNA_BODY(d) + sizeof(uint32)))
+#define DNA_PACKED_BITS(d)      ((const uint8 *) (DNA_RUNS(d) + DNA_NRUNS(d)))
+#define DNA_PACKED_NBYTES(n)    (((Size) (n) + 3) / 4)
+
+/*
+ * Read-only view of the bases of a DNA value
+ *
+ * Plain values are read in place, straight out of the (possibly short
+ * header) datum; only packed values are decoded, into a buffer owned by the
+ * view.  The bases are not NUL-terminated.
+ */
+typedef struct
+{
+    const char *bases;  /* length bases, uppercase */
+    uint32 length;      /* Number of bases */
+    char *buffer;       /* Decoded bases of a packed value, or NULL */
+} DnaView;
+
+/*
+ * Forward reader of the bases of a detoasted DNA value
+ *
+ * Plain values are read in place; packed values are decoded a chunk at a
+ * time, so scanning a long sequence needs only bounded extra memory.
+ */
+#define DNA_CURSOR_CHUNK        4096
+
+typedef struct
+{
+    const dna *d;
+    const char *bases;  /* Bases [start, start + count) */
+    uint32 start;       /* Position of bases[0] */
+    uint32 count;       /* Number of bases available */
+    char buf[DNA_CURSOR_CHUNK]; /* Decoded bases of a packed value */
+} DnaCursor;
+
+void dna_cursor_init(DnaCursor *cur, const dna *d);
+void dna_cursor_fill(DnaCursor *cur, uint32 pos);
+
+/* Base at pos, which must be below the length of the sequence */
+static inline char
+dna_cursor_base(DnaCursor *cur, uint32 pos)
+{
+    if (pos - cur->start >= cur->count)
+        dna_cursor_fill(cur, pos);
+    return cur->bases[pos - cur->start];
+}
+
+/*
+ * Preprocessed needle for substring search (dna_search.c)
+ */
+#define DNA_SEARCH_LONG         32      /* Needles this long use Horspool */
+#define DNA_SEARCH_CHUNK        65536   /* Bases decoded at a time from a packed haystack */
+
+typedef struct
+{
+    const char *needle; /* Needle bases, not owned */
+    uint32 len;         /* Needle length */
+    uint32 shift[1024]; /* Horspool shifts by bigram, for long needles */
+} DnaSearch;
+
+/* Scan of a detoasted haystack for every occurrence of a needle */
+typedef struct
+{
+    const DnaSearch *search;
+    const dna *haystack;
+    uint32 next;        /* Next candidate start */
+    char *buf;          /* Decoded bases of a packed haystack */
+    uint32 buf_start;   /* Position of buf[0] */
+    uint32 buf_count;   /* Number of bases in buf */
+} DnaSearchScan;
+
+void dna_search_init(DnaSearch *search, const char *needle, uint32 len);
+int dna_search_bytes(const DnaSearch *search, const char *text, uint32 text_len,
+                     uint32 from);
+void dna_search_begin(DnaSearchScan *scan, const DnaSearch *search,
+                      const dna *haystack);
+int32 dna_search_next(DnaSearchScan *scan);
+void dna_search_end(DnaSearchScan *scan);
+int32 dna_search_first(const DnaSearch *search, const dna *haystack);
+const DnaSearch *dna_search_cached(FmgrInfo *flinfo, const dna *needle);
+
+/*
+ * Compiled IUPAC pattern for Shift-And matching (dna_pattern.c)
+ */
+typedef struct
+{
+    uint32 len;         /* Pattern length */
+    int nwords;         /* 64-bit words per Shift-And state */
+    uint64 *masks;      /* Pattern positions compatible with each symbol */
+    uint8 symbol[256];  /* Position of each symbol in DNA_SYMBOLS */
+} DnaPattern;
+
+void dna_pattern_init(DnaPattern *pattern, const char *bases, uint32 len);
+int32 dna_pattern_find(const DnaPattern *pattern, const dna *d);
+const DnaPattern *dna_pattern_cached(FmgrInfo *flinfo, const dna *pattern);
+
+/* Edit distance kernel (dna_approx.c) */
+int32 dna_edit_distance_bases(const char *a, uint32 len_a, const char *b, uint32 len_b,
+                              int32 max);
+
+/*
+ * Smith-Waterman local alignment (dna_align.c)
+ *
+ * Identical A, C, G or T bases score match, any other pair mismatch, and a
+ * gap of L bases costs gap_open + (L - 1) * gap_extend.
+ */
+typedef struct
+{
+    int32 match;        /* Positive */
+    int32 mismatch;     /* Zero or negative */
+    int32 gap_open;     /* Penalty, zero or positive */
+    int32 gap_extend;   /* Penalty, at most gap_open */
+} DnaAlignScoring;
+
+#define DNA_ALIGN_MAX_SCORE     127
+
+/* Query compiled for a scoring scheme */
+typedef struct DnaAlignProfile DnaAlignProfile;
+
+/* Best local alignment; coordinates are 0-based, ends exclusive */
+typedef struct
+{
+    int32 score;        /* 0 when nothing aligns */
+    int32 query_start;
+    int32 query_end;
+    int32 target_start;
+    int32 target_end;
+    char *cigar;        /* M/I/D operations, or NULL when not asked for */
+} DnaAlignment;
+
+const DnaAlignProfile *dna_align_cached(FmgrInfo *flinfo, const dna *query,
+                                        const DnaAlignScoring *scoring);
+int32 dna_align_profile_score(const DnaAlignProfile *profile, const char *target,
+                              uint32 len);
+void dna_align_profile_local(const DnaAlignProfile *profile, const char *target,
+                             uint32 len, bool with_cigar, DnaAlignment *result);
+
+/*
+ * Rolling 64-bit k-mer hashes (hash_ops.c)
+ *
+ * ntHash: each base has a random 64-bit seed, and the hash of a window is
+ * the XOR of the seeds rotated by their distance to the end of the window,
+ * so moving the window by one base costs two rotations and three XORs
+ * whatever k is.  The reverse complement strand is hashed alongside, and
+ * the canonical hash of a window is the sum of the hashes of both strands.
+ * Windows containing ambiguity codes or gaps are skipped, and hashing
+ * restarts after them.
+ */
+typedef struct
+{
+    DnaCursor lead;     /* Reads bases entering the window */
+    DnaCursor trail;    /* Reads bases leaving the window */
+    uint32 length;      /* Sequence length */
+    int32 k;
+    bool canonical;     /* Return strand-independent hashes */
+    uint32 pos;         /* Next base to read */
+    uint32 valid;       /* A/C/G/T bases ending just before pos */
+    uint64 forward;     /* Hash of the window */
+    uint64 reverse;     /* Hash of its reverse complement */
+} DnaHashScan;
+
+void dna_hash_scan_init(DnaHashScan *scan, const dna *d, int32 k, bool canonical);
+bool dna_hash_scan_next(DnaHashScan *scan, uint32 *position, uint64 *hash);
+
+/*
+ * K-mer type
+ *
+ * A k-mer is a 64-bit word passed by value.  Each base is a 2-bit code
+ * (A=0, C=1, G=2, T=3) with the first base in the high bits, and a sentinel
+ * bit is set just above the first base so that the length is implied by the
+ * word itself.  Comparing words as unsigned integers therefore orders
+ * k-mers by length first and then lexicographically.
+ */
+typedef uint64 kmer;
+
+#define KMER_MAX_K              31
+#define KMER_SENTINEL(k)        (UINT64CONST(1) << (2 * (k)))
+
+/*
+ * Quality K-mer type (k-mer with quality scores)
+ *
+ * Quality scores are stored either raw (one Phred+33 byte per base) or
+ * binned into Illumina-style levels and packed: 8 levels at 4 bits per base
+ * or 4 levels at 2 bits per base, first base in the high bits.  Padding
+ * slots of the last byte hold the highest level.
+ */
+typedef struct
+{
+    int32 vl_len_;      /* Variable length header */
+    uint32 info;        /* K-mer length and quality encoding */
+    char sequence[FLEXIBLE_ARRAY_MEMBER]; /* Sequence followed by quality scores */
+} qkmer;
+
+#define QKMER_QUAL_RAW          0
+#define QKMER_QUAL_BIN8         1
+#define QKMER_QUAL_BIN4         2
+
+#define QKMER_K_MASK            0x0FFFFFFF
+#define QKMER_QUAL_SHIFT        28
+#define QKMER_K(qk)             ((int32) ((qk)->info & QKMER_K_MASK))
+#define QKMER_QUAL_MODE(qk)     ((int) ((qk)->info >> QKMER_QUAL_SHIFT))
+#define QKMER_QUALITY(qk)       ((const uint8 *) (qk)->sequence + QKMER_K(qk))
+
+/*
+ * MinHash sketch type
+ *
+ * A bottom-s sketch: the s smallest distinct canonical ntHash values of the
+ * k-mers of a set of sequences, sorted ascending.  Fewer than s hashes are
+ * kept only when the sequences hold fewer distinct unambiguous k-mers.
+ */
 typedef struct
 {
     int32 vl_len_;      /* Variable length header */
     int32 k;            /* K-mer length */
-    char data[FLEXIBLE_ARRAY_MEMBER]; /* K-mer sequence data */
-} kmer;
+    int32 size;         /* s, the most hashes kept */
+    int32 count;        /* Number of hashes */
+    uint64 hashes[FLEXIBLE_ARRAY_MEMBER];
+} DnaSketch;
+
+#define DNA_SKETCH_MAX_SIZE     (1 << 20)
+#define DNA_SKETCH_BYTES(n)     (offsetof(DnaSketch, hashes) + (n) * sizeof(uint64))
 
-/* Quality K-mer type (k-mer with quality scores) */
+/*
+ * HyperLogLog type for distinct k-mer counts
+ *
+ * 2^precision one-byte registers, each holding the longest run of leading
+ * zeros (plus one) seen among the hashes routed to it.
+ */
 typedef struct
 {
     int32 vl_len_;      /* Variable length header */
     int32 k;            /* K-mer length */
-    char sequence[FLEXIBLE_ARRAY_MEMBER]; /* Sequence followed by quality scores */
-} qkmer;
+    int32 precision;    /* Bits of hash selecting the register */
+    uint8 registers[FLEXIBLE_ARRAY_MEMBER];
+} KmerHll;
+
+#define KMER_HLL_MIN_PRECISION  4
+#define KMER_HLL_MAX_PRECISION  18
+#define KMER_HLL_DEFAULT_PRECISION 12
+#define KMER_HLL_REGISTERS(p)   (1 << (p))
+#define KMER_HLL_BYTES(p)       (offsetof(KmerHll, registers) + KMER_HLL_REGISTERS(p))
 
 /* Macros for accessing DNA data */
 #define DatumGetDnaP(X)         ((dna *) PG_DETOAST_DATUM(X))
-#define DatumGetKmerP(X)        ((kmer *) PG_DETOAST_DATUM(X))
+#define DatumGetDnaPP(X)        ((dna *) PG_DETOAST_DATUM_PACKED(X))
+#define DatumGetKmer(X)         ((kmer) DatumGetUInt64(X))
+#define KmerGetDatum(X)         UInt64GetDatum(X)
 #define DatumGetQKmerP(X)       ((qkmer *) PG_DETOAST_DATUM(X))
+#define DatumGetDnaSketchP(X)   ((DnaSketch *) PG_DETOAST_DATUM(X))
+#define DatumGetKmerHllP(X)     ((KmerHll *) PG_DETOAST_DATUM(X))
 
 #define PG_GETARG_DNA_P(n)      DatumGetDnaP(PG_GETARG_DATUM(n))
-#define PG_GETARG_KMER_P(n)     DatumGetKmerP(PG_GETARG_DATUM(n))
+/* May have a short header: use VARSIZE_ANY/VARDATA_ANY, not the fields */
+#define PG_GETARG_DNA_PP(n)     DatumGetDnaPP(PG_GETARG_DATUM(n))
+#define PG_GETARG_KMER(n)       DatumGetKmer(PG_GETARG_DATUM(n))
 #define PG_GETARG_QKMER_P(n)    DatumGetQKmerP(PG_GETARG_DATUM(n))
+#define PG_GETARG_DNA_SKETCH_P(n) DatumGetDnaSketchP(PG_GETARG_DATUM(n))
+#define PG_GETARG_KMER_HLL_P(n) DatumGetKmerHllP(PG_GETARG_DATUM(n))
 
 #define PG_RETURN_DNA_P(x)      PG_RETURN_POINTER(x)
-#define PG_RETURN_KMER_P(x)     PG_RETURN_POINTER(x)
+#define PG_RETURN_KMER(x)       return KmerGetDatum(x)
 #define PG_RETURN_QKMER_P(x)    PG_RETURN_POINTER(x)
+#define PG_RETURN_DNA_SKETCH_P(x) PG_RETURN_POINTER(x)
+#define PG_RETURN_KMER_HLL_P(x) PG_RETURN_POINTER(x)
 
 /* Function declarations */
 
@@ -60,15 +361,29 @@ Datum kmer_in(PG_FUNCTION_ARGS);
 Datum kmer_out(PG_FUNCTION_ARGS);
 Datum kmer_recv(PG_FUNCTION_ARGS);
 Datum kmer_send(PG_FUNCTION_ARGS);
+Datum kmer_typmod_in(PG_FUNCTION_ARGS);
+Datum kmer_typmod_out(PG_FUNCTION_ARGS);
+Datum kmer_enforce_typmod(PG_FUNCTION_ARGS);
 
 Datum qkmer_in(PG_FUNCTION_ARGS);
 Datum qkmer_out(PG_FUNCTION_ARGS);
 Datum qkmer_recv(PG_FUNCTION_ARGS);
 Datum qkmer_send(PG_FUNCTION_ARGS);
 
+Datum dna_sketch_in(PG_FUNCTION_ARGS);
+Datum dna_sketch_out(PG_FUNCTION_ARGS);
+Datum dna_sketch_recv(PG_FUNCTION_ARGS);
+Datum dna_sketch_send(PG_FUNCTION_ARGS);
+
+Datum kmer_hll_in(PG_FUNCTION_ARGS);
+Datum kmer_hll_out(PG_FUNCTION_ARGS);
+Datum kmer_hll_recv(PG_FUNCTION_ARGS);
+Datum kmer_hll_send(PG_FUNCTION_ARGS);
+
 /* Utility functions */
 Datum dna_length(PG_FUNCTION_ARGS);
 Datum generate_kmers(PG_FUNCTION_ARGS);
+Datum generate_kmers_srf(PG_FUNCTION_ARGS);
 Datum dna_complement(PG_FUNCTION_ARGS);
 Datum dna_reverse(PG_FUNCTION_ARGS);
 Datum dna_reverse_complement(PG_FUNCTION_ARGS);
@@ -76,6 +391,10 @@ Datum dna_count(PG_FUNCTION_ARGS);
 Datum dna_count_approx(PG_FUNCTION_ARGS);
 Datum dna_to_string(PG_FUNCTION_ARGS);
 Datum string_to_dna(PG_FUNCTION_ARGS);
+Datum dna_substring(PG_FUNCTION_ARGS);
+Datum dna_gc_content_range(PG_FUNCTION_ARGS);
+Datum dna_count_nucleotide_range(PG_FUNCTION_ARGS);
+Datum dna_composition(PG_FUNCTION_ARGS);
 
 /* Operators */
 Datum dna_eq(PG_FUNCTION_ARGS);
@@ -87,10 +406,18 @@ Datum dna_ge(PG_FUNCTION_ARGS);
 Datum dna_cmp(PG_FUNCTION_ARGS);
 Datum dna_contains(PG_FUNCTION_ARGS);
 Datum dna_contained_by(PG_FUNCTION_ARGS);
+Datum dna_iupac_match(PG_FUNCTION_ARGS);
+Datum dna_edit_distance(PG_FUNCTION_ARGS);
+Datum dna_within_distance(PG_FUNCTION_ARGS);
+Datum dna_align_score(PG_FUNCTION_ARGS);
+Datum dna_align_local(PG_FUNCTION_ARGS);
 
 Datum kmer_eq(PG_FUNCTION_ARGS);
 Datum kmer_ne(PG_FUNCTION_ARGS);
 Datum kmer_cmp(PG_FUNCTION_ARGS);
+Datum kmer_canonical_eq(PG_FUNCTION_ARGS);
+Datum kmer_reverse_complement(PG_FUNCTION_ARGS);
+Datum kmer_canonical(PG_FUNCTION_ARGS);
 
 /* Hash support */
 Datum dna_hash(PG_FUNCTION_ARGS);
@@ -115,19 +442,49 @@ Datum dna_in_range(PG_FUNCTION_ARGS);
 Datum dna_gc_content(PG_FUNCTION_ARGS);
 Datum dna_count_nucleotide(PG_FUNCTION_ARGS);
 Datum dna_find_subsequence(PG_FUNCTION_ARGS);
+Datum dna_find_all(PG_FUNCTION_ARGS);
+Datum dna_match_any(PG_FUNCTION_ARGS);
+Datum dna_find_iupac(PG_FUNCTION_ARGS);
+Datum dna_find_approx(PG_FUNCTION_ARGS);
 Datum dna_is_palindrome(PG_FUNCTION_ARGS);
 Datum dna_translate(PG_FUNCTION_ARGS);
+Datum dna_translate_6frame(PG_FUNCTION_ARGS);
 Datum dna_sliding_gc(PG_FUNCTION_ARGS);
+Datum dna_gc_windows(PG_FUNCTION_ARGS);
 Datum dna_overlap(PG_FUNCTION_ARGS);
 Datum dna_similarity(PG_FUNCTION_ARGS);
 Datum dna_hash_extended(PG_FUNCTION_ARGS);
 Datum kmer_hash_extended(PG_FUNCTION_ARGS);
+Datum kmer_canonical_hash(PG_FUNCTION_ARGS);
+Datum kmer_canonical_hash_extended(PG_FUNCTION_ARGS);
 Datum qkmer_hash(PG_FUNCTION_ARGS);
 Datum qkmer_hash_extended(PG_FUNCTION_ARGS);
 Datum dna_kmer_hashes(PG_FUNCTION_ARGS);
+Datum dna_kmer_hashes_srf(PG_FUNCTION_ARGS);
+Datum dna_minimizers(PG_FUNCTION_ARGS);
+Datum dna_syncmers(PG_FUNCTION_ARGS);
+Datum dna_sketch(PG_FUNCTION_ARGS);
+Datum dna_sketch_union(PG_FUNCTION_ARGS);
+Datum dna_sketch_agg_trans(PG_FUNCTION_ARGS);
+Datum dna_sketch_agg_combine(PG_FUNCTION_ARGS);
+Datum dna_sketch_agg_serialize(PG_FUNCTION_ARGS);
+Datum dna_sketch_agg_deserialize(PG_FUNCTION_ARGS);
+Datum dna_sketch_agg_final(PG_FUNCTION_ARGS);
+Datum dna_sketch_jaccard(PG_FUNCTION_ARGS);
+Datum dna_sketch_containment(PG_FUNCTION_ARGS);
+Datum dna_sketch_distance(PG_FUNCTION_ARGS);
+Datum kmer_hll(PG_FUNCTION_ARGS);
+Datum kmer_hll_union(PG_FUNCTION_ARGS);
+Datum kmer_hll_cardinality(PG_FUNCTION_ARGS);
+Datum kmer_hll_agg_trans(PG_FUNCTION_ARGS);
+Datum kmer_hll_agg_combine(PG_FUNCTION_ARGS);
+Datum kmer_hll_agg_serialize(PG_FUNCTION_ARGS);
+Datum kmer_hll_agg_deserialize(PG_FUNCTION_ARGS);
+Datum kmer_hll_agg_final(PG_FUNCTION_ARGS);
 Datum qkmer_avg_quality(PG_FUNCTION_ARGS);
 Datum qkmer_min_quality(PG_FUNCTION_ARGS);
 Datum qkmer_filter_quality(PG_FUNCTION_ARGS);
+Datum qkmer_bin_quality(PG_FUNCTION_ARGS);
 
 /* SP-GiST support */
 Datum spgist_kmer_config(PG_FUNCTION_ARGS);
@@ -138,10 +495,37 @@ Datum spgist_kmer_leaf_consistent(PG_FUNCTION_ARGS);
 
 /* Internal utility functions */
 int dna_compare_internal(const dna *a, const dna *b);
-int kmer_compare_internal(const kmer *a, const kmer *b);
+bool dna_equal_internal(const dna *a, const dna *b);
+int dna_find_internal(const dna *haystack, const dna *needle);
+char *dna_fetch_range(Datum datum, int32 start, int32 count, int32 *nfetched);
+bool dna_fetch_summary(Datum datum, DnaSummary *summary, uint32 *length);
+uint32 dna_get_counts(Datum datum, uint32 *counts);
+int kmer_compare_internal(kmer a, kmer b);
 char *dna_get_str(const dna *d);
-char *kmer_get_str(const kmer *k);
+DnaView dna_get_view(Datum datum);
+void dna_release_view(DnaView *view);
+char *kmer_get_str(kmer k);
 int dna_get_length(const dna *d);
-int kmer_get_k(const kmer *k);
+int kmer_get_k(kmer k);
+char kmer_base_at(kmer k, int pos);
+bool kmer_encode(const char *bases, int k, kmer *result);
+kmer kmer_revcomp_word(kmer k);
+kmer kmer_canonical_word(kmer k);
+
+/* Input normalization (dna_normalize.c) */
+int dna_normalize(const char *src, char *dst, int len);
+
+/* Complement kernels (dna_revcomp.c) */
+dna *dna_transform(const dna *d, bool reverse, bool complement);
+
+/* Packed storage (dna_pack.c) */
+dna *dna_make(const char *bases, uint32 len);
+int dna_symbol_index(char c);
+void dna_count_symbols(const dna *d, uint32 *counts);
+void dna_unpack(const dna *d, uint32 start, uint32 count, char *out);
+void dna_unpack_packed(const uint8 *bits, uint32 bits_origin,
+                       const DnaRun *runs, uint32 nruns,
+                       uint32 start, uint32 count, char *out);
+int dna_packed_compare(const uint8 *a, const uint8 *b, uint32 nbases);
 
 #endif /* DNA_H */
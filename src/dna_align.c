@@ -0,0 +1,797 @@
+#include "dna.h"
+#include <string.h>
+#include "lib/stringinfo.h"
+#include "utils/memutils.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Smith-Waterman local alignment with affine gaps
+ *
+ * The kernel is Farrar's striped algorithm: the query is split into
+ * segments laid out across the lanes of a vector, so a whole column of
+ * the dynamic programming matrix is computed with one vector operation per
+ * segment, and vertical gaps crossing segment boundaries are fixed up by a
+ * short "lazy F" loop.  Scores first run in 16 unsigned 8-bit lanes; if
+ * they saturate the target is realigned with 8 signed 16-bit lanes, and
+ * beyond that with the scalar kernel, which is also used without SSE2.
+ *
+ * Each pass yields the score and the end of the best alignment.  Its start
+ * is found by aligning the reversed prefixes that end there, and the CIGAR
+ * by a global alignment of the two aligned ranges only.
+ */
+
+struct DnaAlignProfile
+{
+    DnaAlignScoring scoring;
+    const char *bases;  /* Query bases, referenced */
+    uint32 len;         /* Query length */
+#if defined(__SSE2__)
+    uint8 symbol[256];  /* Position of each symbol in DNA_SYMBOLS */
+    int32 seglen8;      /* Segments of the 8-bit profile */
+    int32 seglen16;     /* Segments of the 16-bit profile */
+    __m128i *profile8;  /* Biased scores, DNA_NSYMBOLS * seglen8 vectors */
+    __m128i *profile16; /* Scores, DNA_NSYMBOLS * seglen16 vectors */
+    char *raw;          /* Allocation holding both profiles */
+#endif
+};
+
+/* Score and end of the best alignment found by a pass */
+typedef struct
+{
+    int32 score;
+    int32 query_end;    /* Last aligned query base, or -1 */
+    int32 target_end;   /* Last aligned target base, or -1 */
+} AlignEnd;
+
+static inline int32
+align_pair(const DnaAlignScoring *scoring, char q, char t)
+{
+    if (q == t && (q == 'A' || q == 'C' || q == 'G' || q == 'T'))
+        return scoring->match;
+    return scoring->mismatch;
+}
+
+/*
+ * Allocate a 16-byte aligned array of vectors
+ * *raw receives the pointer to free.
+ */
+static void *
+align_alloc(Size size, char **raw)
+{
+    *raw = palloc0(size + 15);
+    return (void *) TYPEALIGN(16, *raw);
+}
+
+/*
+ * Compile a query
+ * The bases are referenced, not copied, and must outlive the profile.
+ */
+static void
+align_profile_init(DnaAlignProfile *profile, const char *bases, uint32 len,
+                   const DnaAlignScoring *scoring)
+{
+#if defined(__SSE2__)
+    uint8 *p8;
+    int16 *p16;
+    int32 bias = -scoring->mismatch;
+    int sym;
+    int32 seg;
+    int lane;
+#endif
+    
+    profile->scoring = *scoring;
+    profile->bases = bases;
+    profile->len = len;
+    
+#if defined(__SSE2__)
+    profile->seglen8 = Max((len + 15) / 16, 1);
+    profile->seglen16 = Max((len + 7) / 8, 1);
+    profile->profile8 = align_alloc(DNA_NSYMBOLS * (profile->seglen8 + profile->seglen16) *
+                                    sizeof(__m128i), &profile->raw);
+    profile->profile16 = profile->profile8 + DNA_NSYMBOLS * profile->seglen8;
+    
+    memset(profile->symbol, 0, sizeof(profile->symbol));
+    p8 = (uint8 *) profile->profile8;
+    p16 = (int16 *) profile->profile16;
+    
+    /*
+     * Lane l of segment s holds query base l * seglen + s.  Padding past the
+     * end of the query scores as a mismatch, so it never extends the best
+     * alignment.
+     */
+    for (sym = 0; sym < DNA_NSYMBOLS; sym++)
+    {
+        char t = DNA_SYMBOLS[sym];
+        
+        profile->symbol[(uint8) t] = sym;
+        
+        for (seg = 0; seg < profile->seglen8; seg++)
+        {
+            for (lane = 0; lane < 16; lane++)
+            {
+                uint32 pos = lane * profile->seglen8 + seg;
+                
+                *p8++ = pos < len ? align_pair(scoring, bases[pos], t) + bias : 0;
+            }
+        }
+        
+        for (seg = 0; seg < profile->seglen16; seg++)
+        {
+            for (lane = 0; lane < 8; lane++)
+            {
+                uint32 pos = lane * profile->seglen16 + seg;
+                
+                *p16++ = pos < len ? align_pair(scoring, bases[pos], t) : scoring->mismatch;
+            }
+        }
+    }
+#endif
+}
+
+static void
+align_profile_free(DnaAlignProfile *profile)
+{
+#if defined(__SSE2__)
+    pfree(profile->raw);
+#else
+    (void) profile;
+#endif
+}
+
+/*
+ * Scalar kernel, one target base per column
+ * Ties go to the first column, then to the first query base, like the
+ * striped kernels.
+ */
+static void
+align_scalar(const DnaAlignProfile *profile, const char *target, uint32 len,
+             AlignEnd *end)
+{
+    const DnaAlignScoring *scoring = &profile->scoring;
+    const char *query = profile->bases;
+    uint32 qlen = profile->len;
+    int32 *h = palloc0(Max(qlen, 1) * sizeof(int32));
+    int32 *e = palloc0(Max(qlen, 1) * sizeof(int32));
+    uint32 i;
+    uint32 j;
+    
+    end->score = 0;
+    end->query_end = -1;
+    end->target_end = -1;
+    
+    for (j = 0; j < len; j++)
+    {
+        int32 diag = 0;
+        int32 f = 0;
+        
+        for (i = 0; i < qlen; i++)
+        {
+            int32 score = diag + align_pair(scoring, query[i], target[j]);
+            
+            score = Max(score, e[i]);
+            score = Max(score, f);
+            score = Max(score, 0);
+            
+            diag = h[i];
+            h[i] = score;
+            e[i] = Max(e[i] - scoring->gap_extend, score - scoring->gap_open);
+            f = Max(f - scoring->gap_extend, score - scoring->gap_open);
+            
+            if (score > end->score)
+            {
+                end->score = score;
+                end->query_end = i;
+                end->target_end = j;
+            }
+        }
+    }
+    
+    pfree(h);
+    pfree(e);
+}
+
+#if defined(__SSE2__)
+
+static inline int32
+align_hmax8(__m128i v)
+{
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+    return _mm_cvtsi128_si32(v) & 0xFF;
+}
+
+static inline int32
+align_hmax16(__m128i v)
+{
+    v = _mm_max_epi16(v, _mm_srli_si128(v, 8));
+    v = _mm_max_epi16(v, _mm_srli_si128(v, 4));
+    v = _mm_max_epi16(v, _mm_srli_si128(v, 2));
+    return (int16) _mm_extract_epi16(v, 0);
+}
+
+/*
+ * Striped kernel on 8-bit lanes
+ *
+ * Scores are kept biased by -mismatch so that every profile entry is
+ * unsigned, and saturating arithmetic clamps them at zero for free.
+ * Returns false if the best score may have saturated.  With locate, the
+ * column holding the best score is saved to find the query end.
+ */
+static bool
+align_striped8(const DnaAlignProfile *profile, const char *target, uint32 len,
+               bool locate, AlignEnd *end)
+{
+    int32 seglen = profile->seglen8;
+    int32 bias = -profile->scoring.mismatch;
+    const __m128i vzero = _mm_setzero_si128();
+    const __m128i vbias = _mm_set1_epi8((char) bias);
+    const __m128i vgap_open = _mm_set1_epi8((char) profile->scoring.gap_open);
+    const __m128i vgap_extend = _mm_set1_epi8((char) profile->scoring.gap_extend);
+    __m128i *hstore;
+    __m128i *hload;
+    __m128i *ve;
+    __m128i *hbest;
+    char *raw;
+    bool ok = true;
+    uint32 j;
+    
+    hstore = align_alloc(4 * seglen * sizeof(__m128i), &raw);
+    hload = hstore + seglen;
+    ve = hload + seglen;
+    hbest = ve + seglen;
+    
+    end->score = 0;
+    end->query_end = -1;
+    end->target_end = -1;
+    
+    for (j = 0; j < len; j++)
+    {
+        const __m128i *vp = profile->profile8 + profile->symbol[(uint8) target[j]] * seglen;
+        __m128i vf = vzero;
+        __m128i vmax = vzero;
+        __m128i vh;
+        __m128i *swap;
+        int32 i;
+        int32 colmax;
+        
+        /* The diagonal of the first segment comes from the previous lane */
+        vh = _mm_slli_si128(hstore[seglen - 1], 1);
+        swap = hload;
+        hload = hstore;
+        hstore = swap;
+        
+        for (i = 0; i < seglen; i++)
+        {
+            __m128i e = ve[i];
+            
+            vh = _mm_adds_epu8(vh, vp[i]);
+            vh = _mm_subs_epu8(vh, vbias);
+            vh = _mm_max_epu8(vh, e);
+            vh = _mm_max_epu8(vh, vf);
+            vmax = _mm_max_epu8(vmax, vh);
+            hstore[i] = vh;
+            
+            vh = _mm_subs_epu8(vh, vgap_open);
+            ve[i] = _mm_max_epu8(_mm_subs_epu8(e, vgap_extend), vh);
+            vf = _mm_max_epu8(_mm_subs_epu8(vf, vgap_extend), vh);
+            
+            vh = hload[i];
+        }
+        
+        /* Carry vertical gaps into the next lane until they stop mattering */
+        vf = _mm_slli_si128(vf, 1);
+        i = 0;
+        for (;;)
+        {
+            __m128i hopen = _mm_subs_epu8(hstore[i], vgap_open);
+            
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(vf, hopen), vzero)) == 0xFFFF)
+                break;
+            
+            vh = _mm_max_epu8(hstore[i], vf);
+            vmax = _mm_max_epu8(vmax, vh);
+            hstore[i] = vh;
+            ve[i] = _mm_max_epu8(ve[i], _mm_subs_epu8(vh, vgap_open));
+            vf = _mm_subs_epu8(vf, vgap_extend);
+            
+            if (++i == seglen)
+            {
+                i = 0;
+                vf = _mm_slli_si128(vf, 1);
+            }
+        }
+        
+        colmax = align_hmax8(vmax);
+        if (colmax > end->score)
+        {
+            if (colmax + bias >= 255)
+            {
+                ok = false;
+                break;
+            }
+            end->score = colmax;
+            end->target_end = j;
+            if (locate)
+                memcpy(hbest, hstore, seglen * sizeof(__m128i));
+        }
+    }
+    
+    if (ok && locate && end->score > 0)
+    {
+        const uint8 *cells = (const uint8 *) hbest;
+        uint32 pos;
+        
+        for (pos = 0; pos < profile->len; pos++)
+        {
+            if (cells[(pos % seglen) * 16 + pos / seglen] == end->score)
+            {
+                end->query_end = pos;
+                break;
+            }
+        }
+    }
+    
+    pfree(raw);
+    
+    return ok;
+}
+
+/*
+ * Striped kernel on 16-bit lanes
+ * Returns false if the best score may have saturated.
+ */
+static bool
+align_striped16(const DnaAlignProfile *profile, const char *target, uint32 len,
+                bool locate, AlignEnd *end)
+{
+    int32 seglen = profile->seglen16;
+    const __m128i vzero = _mm_setzero_si128();
+    const __m128i vgap_open = _mm_set1_epi16((int16) profile->scoring.gap_open);
+    const __m128i vgap_extend = _mm_set1_epi16((int16) profile->scoring.gap_extend);
+    __m128i *hstore;
+    __m128i *hload;
+    __m128i *ve;
+    __m128i *hbest;
+    char *raw;
+    bool ok = true;
+    uint32 j;
+    
+    hstore = align_alloc(4 * seglen * sizeof(__m128i), &raw);
+    hload = hstore + seglen;
+    ve = hload + seglen;
+    hbest = ve + seglen;
+    
+    end->score = 0;
+    end->query_end = -1;
+    end->target_end = -1;
+    
+    for (j = 0; j < len; j++)
+    {
+        const __m128i *vp = profile->profile16 + profile->symbol[(uint8) target[j]] * seglen;
+        __m128i vf = vzero;
+        __m128i vmax = vzero;
+        __m128i vh;
+        __m128i *swap;
+        int32 i;
+        int32 colmax;
+        
+        vh = _mm_slli_si128(hstore[seglen - 1], 2);
+        swap = hload;
+        hload = hstore;
+        hstore = swap;
+        
+        /*
+         * Cells are never negative once E and F are folded in, so unsigned
+         * saturating subtraction clamps the gap terms at zero.
+         */
+        for (i = 0; i < seglen; i++)
+        {
+            __m128i e = ve[i];
+            
+            vh = _mm_adds_epi16(vh, vp[i]);
+            vh = _mm_max_epi16(vh, e);
+            vh = _mm_max_epi16(vh, vf);
+            vmax = _mm_max_epi16(vmax, vh);
+            hstore[i] = vh;
+            
+            vh = _mm_subs_epu16(vh, vgap_open);
+            ve[i] = _mm_max_epi16(_mm_subs_epu16(e, vgap_extend), vh);
+            vf = _mm_max_epi16(_mm_subs_epu16(vf, vgap_extend), vh);
+            
+            vh = hload[i];
+        }
+        
+        vf = _mm_slli_si128(vf, 2);
+        i = 0;
+        for (;;)
+        {
+            __m128i hopen = _mm_subs_epu16(hstore[i], vgap_open);
+            
+            if (_mm_movemask_epi8(_mm_cmpgt_epi16(vf, hopen)) == 0)
+                break;
+            
+            vh = _mm_max_epi16(hstore[i], vf);
+            vmax = _mm_max_epi16(vmax, vh);
+            hstore[i] = vh;
+            ve[i] = _mm_max_epi16(ve[i], _mm_subs_epu16(vh, vgap_open));
+            vf = _mm_subs_epu16(vf, vgap_extend);
+            
+            if (++i == seglen)
+            {
+                i = 0;
+                vf = _mm_slli_si128(vf, 2);
+            }
+        }
+        
+        colmax = align_hmax16(vmax);
+        if (colmax > end->score)
+        {
+            if (colmax + profile->scoring.match >= PG_INT16_MAX)
+            {
+                ok = false;
+                break;
+            }
+            end->score = colmax;
+            end->target_end = j;
+            if (locate)
+                memcpy(hbest, hstore, seglen * sizeof(__m128i));
+        }
+    }
+    
+    if (ok && locate && end->score > 0)
+    {
+        const int16 *cells = (const int16 *) hbest;
+        uint32 pos;
+        
+        for (pos = 0; pos < profile->len; pos++)
+        {
+            if (cells[(pos % seglen) * 8 + pos / seglen] == end->score)
+            {
+                end->query_end = pos;
+                break;
+            }
+        }
+    }
+    
+    pfree(raw);
+    
+    return ok;
+}
+
+#endif
+
+/*
+ * Best local alignment of a query against target bases
+ * Narrow lanes are tried first and widened only when they saturate.
+ */
+static void
+align_run(const DnaAlignProfile *profile, const char *target, uint32 len,
+          bool locate, AlignEnd *end)
+{
+    if (profile->len == 0 || len == 0)
+    {
+        end->score = 0;
+        end->query_end = -1;
+        end->target_end = -1;
+        return;
+    }
+    
+#if defined(__SSE2__)
+    if (align_striped8(profile, target, len, locate, end))
+        return;
+    if (align_striped16(profile, target, len, locate, end))
+        return;
+#else
+    (void) locate;
+#endif
+    
+    align_scalar(profile, target, len, end);
+}
+
+/* Traceback flags of the global alignment */
+#define ALIGN_FROM_DIAG         0
+#define ALIGN_FROM_E            1
+#define ALIGN_FROM_F            2
+#define ALIGN_SOURCE            3
+#define ALIGN_E_EXTEND          4
+#define ALIGN_F_EXTEND          8
+
+/*
+ * CIGAR of the best global alignment of two ranges (Gotoh)
+ * E gaps skip target bases (D), F gaps skip query bases (I).
+ */
+static char *
+align_cigar(const DnaAlignScoring *scoring, const char *query, uint32 qlen,
+            const char *target, uint32 tlen)
+{
+    const int32 neg = PG_INT32_MIN / 2;
+    Size cols = tlen + 1;
+    uint8 *trace;
+    int32 *h;
+    int32 *f;
+    char *ops;
+    int32 nops = 0;
+    int state = ALIGN_FROM_DIAG;
+    StringInfoData buf;
+    uint32 i;
+    uint32 j;
+    
+    if ((double) (qlen + 1) * cols > MaxAllocSize)
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg("alignment is too long to produce a CIGAR string")));
+    
+    trace = palloc((qlen + 1) * cols);
+    h = palloc(cols * sizeof(int32));
+    f = palloc(cols * sizeof(int32));
+    
+    h[0] = 0;
+    trace[0] = ALIGN_FROM_DIAG;
+    for (j = 1; j <= tlen; j++)
+    {
+        h[j] = -(scoring->gap_open + (int32) (j - 1) * scoring->gap_extend);
+        f[j] = neg;
+        trace[j] = ALIGN_FROM_E | (j > 1 ? ALIGN_E_EXTEND : 0);
+    }
+    
+    for (i = 1; i <= qlen; i++)
+    {
+        uint8 *row = trace + i * cols;
+        int32 diag = h[0];
+        int32 e = neg;
+        
+        h[0] = -(scoring->gap_open + (int32) (i - 1) * scoring->gap_extend);
+        row[0] = ALIGN_FROM_F | (i > 1 ? ALIGN_F_EXTEND : 0);
+        
+        for (j = 1; j <= tlen; j++)
+        {
+            uint8 flags = 0;
+            int32 open;
+            int32 score;
+            
+            /* h[j - 1] is already this row's, h[j] still the previous row's */
+            open = h[j - 1] - scoring->gap_open;
+            if (e - scoring->gap_extend > open)
+            {
+                e -= scoring->gap_extend;
+                flags |= ALIGN_E_EXTEND;
+            }
+            else
+                e = open;
+            
+            open = h[j] - scoring->gap_open;
+            if (f[j] - scoring->gap_extend > open)
+            {
+                f[j] -= scoring->gap_extend;
+                flags |= ALIGN_F_EXTEND;
+            }
+            else
+                f[j] = open;
+            
+            score = diag + align_pair(scoring, query[i - 1], target[j - 1]);
+            if (e > score)
+            {
+                score = e;
+                flags |= ALIGN_FROM_E;
+            }
+            if (f[j] > score)
+            {
+                score = f[j];
+                flags = (flags & ~ALIGN_SOURCE) | ALIGN_FROM_F;
+            }
+            
+            diag = h[j];
+            h[j] = score;
+            row[j] = flags;
+        }
+    }
+    
+    /* Walk back from the bottom right corner, collecting operations in reverse */
+    ops = palloc(qlen + tlen);
+    i = qlen;
+    j = tlen;
+    while (i > 0 || j > 0)
+    {
+        uint8 flags = trace[i * cols + j];
+        
+        if (state == ALIGN_FROM_DIAG)
+        {
+            state = flags & ALIGN_SOURCE;
+            if (state == ALIGN_FROM_DIAG)
+            {
+                ops[nops++] = 'M';
+                i--;
+                j--;
+                continue;
+            }
+        }
+        
+        if (state == ALIGN_FROM_E)
+        {
+            ops[nops++] = 'D';
+            j--;
+            if ((flags & ALIGN_E_EXTEND) == 0)
+                state = ALIGN_FROM_DIAG;
+        }
+        else
+        {
+            ops[nops++] = 'I';
+            i--;
+            if ((flags & ALIGN_F_EXTEND) == 0)
+                state = ALIGN_FROM_DIAG;
+        }
+    }
+    
+    initStringInfo(&buf);
+    while (nops > 0)
+    {
+        char op = ops[nops - 1];
+        int32 run = 0;
+        
+        while (nops > 0 && ops[nops - 1] == op)
+        {
+            run++;
+            nops--;
+        }
+        appendStringInfo(&buf, "%d%c", run, op);
+    }
+    
+    pfree(trace);
+    pfree(h);
+    pfree(f);
+    pfree(ops);
+    
+    return buf.data;
+}
+
+/*
+ * Score of the best local alignment of the query against target bases
+ * This is the fast path: the query end is not tracked.
+ */
+int32
+dna_align_profile_score(const DnaAlignProfile *profile, const char *target,
+                        uint32 len)
+{
+    AlignEnd end;
+    
+    align_run(profile, target, len, false, &end);
+    
+    return end.score;
+}
+
+/*
+ * Best local alignment of the query against target bases, with its
+ * coordinates and optionally its CIGAR
+ * Coordinates are -1 and the CIGAR NULL when the score is 0.
+ */
+void
+dna_align_profile_local(const DnaAlignProfile *profile, const char *target,
+                        uint32 len, bool with_cigar, DnaAlignment *result)
+{
+    DnaAlignProfile reverse;
+    AlignEnd end;
+    AlignEnd start;
+    char *query_rev;
+    char *target_rev;
+    uint32 qlen;
+    uint32 tlen;
+    uint32 i;
+    
+    result->score = 0;
+    result->query_start = -1;
+    result->query_end = -1;
+    result->target_start = -1;
+    result->target_end = -1;
+    result->cigar = NULL;
+    
+    align_run(profile, target, len, true, &end);
+    if (end.score <= 0)
+        return;
+    
+    /*
+     * The alignment read backwards from its end is the best one of the
+     * reversed prefixes, and its end there is the start we are after.
+     */
+    qlen = end.query_end + 1;
+    tlen = end.target_end + 1;
+    query_rev = palloc(qlen);
+    target_rev = palloc(tlen);
+    for (i = 0; i < qlen; i++)
+        query_rev[i] = profile->bases[qlen - 1 - i];
+    for (i = 0; i < tlen; i++)
+        target_rev[i] = target[tlen - 1 - i];
+    
+    align_profile_init(&reverse, query_rev, qlen, &profile->scoring);
+    align_run(&reverse, target_rev, tlen, true, &start);
+    align_profile_free(&reverse);
+    Assert(start.score == end.score);
+    
+    result->score = end.score;
+    result->query_start = end.query_end - start.query_end;
+    result->query_end = end.query_end + 1;
+    result->target_start = end.target_end - start.target_end;
+    result->target_end = end.target_end + 1;
+    
+    if (with_cigar)
+        result->cigar = align_cigar(&profile->scoring,
+                                    profile->bases + result->query_start,
+                                    result->query_end - result->query_start,
+                                    target + result->target_start,
+                                    result->target_end - result->target_start);
+    
+    pfree(query_rev);
+    pfree(target_rev);
+}
+
+/*
+ * Compiled query kept across calls in fn_extra, like DnaSearchCache
+ */
+typedef struct
+{
+    MemoryContext context;      /* Holds everything below */
+    DnaAlignProfile profile;
+    char *datum;        /* Copy of the query the profile was built from */
+    Size size;          /* Size of that copy */
+} DnaAlignCache;
+
+/*
+ * Get the profile of a detoasted query for a scoring scheme, reusing the
+ * cached one when neither has changed since the previous call
+ */
+const DnaAlignProfile *
+dna_align_cached(FmgrInfo *flinfo, const dna *query, const DnaAlignScoring *scoring)
+{
+    DnaAlignCache *cache = (DnaAlignCache *) flinfo->fn_extra;
+    Size size = VARSIZE(query);
+    MemoryContext context;
+    MemoryContext oldcontext;
+    char *bases;
+    
+    if (cache != NULL && cache->size == size &&
+        memcmp(&cache->profile.scoring, scoring, sizeof(DnaAlignScoring)) == 0 &&
+        memcmp(cache->datum, query, size) == 0)
+        return &cache->profile;
+    
+    if (scoring->match <= 0 || scoring->match > DNA_ALIGN_MAX_SCORE ||
+        scoring->mismatch > 0 || scoring->mismatch < -DNA_ALIGN_MAX_SCORE)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("match must be between 1 and %d and mismatch between %d and 0",
+                        DNA_ALIGN_MAX_SCORE, -DNA_ALIGN_MAX_SCORE)));
+    
+    /* A cheaper extension than opening would make a run of gaps ambiguous */
+    if (scoring->gap_extend < 0 || scoring->gap_extend > scoring->gap_open ||
+        scoring->gap_open > DNA_ALIGN_MAX_SCORE)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("gap penalties must satisfy 0 <= gap_extend <= gap_open <= %d",
+                        DNA_ALIGN_MAX_SCORE)));
+    
+    if (cache != NULL)
+        MemoryContextDelete(cache->context);
+    
+    context = AllocSetContextCreate(flinfo->fn_mcxt, "dna_align profile",
+                                    ALLOCSET_SMALL_SIZES);
+    oldcontext = MemoryContextSwitchTo(context);
+    
+    cache = palloc0(sizeof(DnaAlignCache));
+    cache->context = context;
+    cache->datum = palloc(size);
+    memcpy(cache->datum, query, size);
+    cache->size = size;
+    
+    bases = palloc(Max(query->length, 1));
+    dna_unpack(query, 0, query->length, bases);
+    align_profile_init(&cache->profile, bases, query->length, scoring);
+    
+    MemoryContextSwitchTo(oldcontext);
+    
+    flinfo->fn_extra = cache;
+    
+    return &cache->profile;
+}
@@ -0,0 +1,409 @@
+#include "dna.h"
+#include <string.h>
+#include "funcapi.h"
+
+/*
+ * Approximate substring search
+ *
+ * Both modes run over the compiled IUPAC pattern of dna_pattern.c, so a
+ * position counts as an error only when the needle and sequence bases are
+ * incompatible.
+ *
+ * Hamming mode keeps one Shift-And state per number of mismatches
+ * (Wu-Manber): state d has bit i set when the first i + 1 needle bases
+ * match the text ending here with at most d substitutions.
+ *
+ * Edit mode is Myers' bit-vector algorithm, which tracks the vertical
+ * deltas of a column of the edit distance matrix in two bit vectors and
+ * advances a whole column per sequence base.  Needles longer than 64 bases
+ * are split into 64-bit blocks, the horizontal delta out of each block
+ * feeding the next one.  Myers only reports where a match ends; the start
+ * is found afterwards with a small dynamic program over the bases before
+ * the end.
+ */
+
+typedef struct
+{
+    DnaPattern pattern; /* Compiled needle */
+    char *needle;       /* Needle bases */
+    const dna *d;       /* Detoasted sequence */
+    DnaCursor cur;      /* Reader of the sequence */
+    bool edit;          /* Edit distance, else Hamming distance */
+    int max_errors;
+    uint32 pos;         /* Next sequence position to read */
+    uint64 *state;      /* Hamming: max_errors + 1 states; edit: Pv then Mv */
+    int32 score;        /* Edit: distance of the best match ending at pos - 1 */
+    int32 *column;      /* Edit: dynamic programming column */
+    char *window;       /* Edit: bases before a match end */
+    uint32 start;       /* Start of the last match */
+    uint32 length;      /* Length of the last match */
+    int32 distance;     /* Distance of the last match */
+} ApproxScan;
+
+/*
+ * Advance the Hamming states over one sequence base
+ * Returns the smallest number of mismatches of a match ending at this
+ * base, or -1
+ */
+static int
+approx_hamming_step(ApproxScan *scan, const uint64 *eq)
+{
+    int nwords = scan->pattern.nwords;
+    int last = (scan->pattern.len - 1) / 64;
+    uint64 hit = UINT64CONST(1) << ((scan->pattern.len - 1) % 64);
+    int result = -1;
+    int e;
+    int w;
+    
+    /* Update from the most errors down, so that state e - 1 is still old */
+    for (e = scan->max_errors; e >= 0; e--)
+    {
+        uint64 *state = scan->state + e * nwords;
+        uint64 *fewer = e > 0 ? state - nwords : NULL;
+        uint64 carry = 1;
+        uint64 carry_fewer = 1;
+        
+        for (w = 0; w < nwords; w++)
+        {
+            uint64 next = ((state[w] << 1) | carry) & eq[w];
+            
+            carry = state[w] >> 63;
+            if (fewer != NULL)
+            {
+                /* A substitution moves on from one error fewer */
+                next |= (fewer[w] << 1) | carry_fewer;
+                carry_fewer = fewer[w] >> 63;
+            }
+            state[w] = next;
+        }
+        
+        if ((state[last] & hit) != 0)
+            result = e;
+    }
+    
+    return result;
+}
+
+/*
+ * Advance Myers' column over one sequence base
+ * Returns the distance of the best match ending at this base
+ */
+static int32
+approx_edit_step(ApproxScan *scan, const uint64 *eq)
+{
+    int nwords = scan->pattern.nwords;
+    int lastbit = (scan->pattern.len - 1) % 64;
+    uint64 *pv = scan->state;
+    uint64 *mv = scan->state + nwords;
+    int hin = 0;        /* Matches may start anywhere: no delta on the top row */
+    int w;
+    
+    for (w = 0; w < nwords; w++)
+    {
+        uint64 hneg = hin < 0 ? 1 : 0;
+        uint64 hpos = hin > 0 ? 1 : 0;
+        uint64 e = eq[w] | hneg;
+        uint64 xv = eq[w] | mv[w];
+        uint64 xh = (((e & pv[w]) + pv[w]) ^ pv[w]) | e;
+        uint64 ph = mv[w] | ~(xh | pv[w]);
+        uint64 mh = pv[w] & xh;
+        
+        if (w == nwords - 1)
+            scan->score += (int) ((ph >> lastbit) & 1) - (int) ((mh >> lastbit) & 1);
+        else
+            hin = (int) (ph >> 63) - (int) (mh >> 63);
+        
+        ph = (ph << 1) | hpos;
+        mh = (mh << 1) | hneg;
+        pv[w] = mh | ~(xv | ph);
+        mv[w] = ph & xv;
+    }
+    
+    return scan->score;
+}
+
+/*
+ * Find the start of a match of distance dist ending at end
+ *
+ * Aligns the needle backwards from end; among the starts reaching dist,
+ * the one giving a match closest to the needle length is kept.
+ */
+static void
+approx_locate(ApproxScan *scan, uint32 end, int32 dist)
+{
+    uint32 len = scan->pattern.len;
+    uint32 span = Min(end + 1, len + scan->max_errors);
+    int32 *column = scan->column;
+    uint32 best = 0;
+    uint32 i;
+    uint32 j;
+    
+    dna_unpack(scan->d, end + 1 - span, span, scan->window);
+    
+    /* column[i]: distance of the last i needle bases to the last j bases */
+    for (i = 0; i <= len; i++)
+        column[i] = i;
+    
+    for (j = 1; j <= span; j++)
+    {
+        uint8 base = iupac_base_mask[(uint8) scan->window[span - j]];
+        int32 diag = column[0];
+        
+        column[0] = j;
+        for (i = 1; i <= len; i++)
+        {
+            int32 up = column[i];
+            int32 cost = (iupac_base_mask[(uint8) scan->needle[len - i]] & base) ? 0 : 1;
+            
+            column[i] = Min(Min(diag + cost, up + 1), column[i - 1] + 1);
+            diag = up;
+        }
+        
+        if (column[len] == dist &&
+            (best == 0 || Abs((int32) j - (int32) len) < Abs((int32) best - (int32) len)))
+            best = j;
+    }
+    
+    Assert(best > 0);
+    
+    scan->start = end + 1 - best;
+    scan->length = best;
+}
+
+/*
+ * Move to the next match
+ * Returns false when the sequence is exhausted
+ */
+static bool
+approx_next(ApproxScan *scan)
+{
+    uint32 len = scan->pattern.len;
+    
+    while (scan->pos < scan->d->length)
+    {
+        uint32 end = scan->pos++;
+        int sym = scan->pattern.symbol[(uint8) dna_cursor_base(&scan->cur, end)];
+        const uint64 *eq = scan->pattern.masks + sym * scan->pattern.nwords;
+        
+        if (!scan->edit)
+        {
+            int dist = approx_hamming_step(scan, eq);
+            
+            if (dist >= 0)
+            {
+                scan->start = end + 1 - len;
+                scan->length = len;
+                scan->distance = dist;
+                return true;
+            }
+        }
+        else if (approx_edit_step(scan, eq) <= scan->max_errors)
+        {
+            scan->distance = scan->score;
+            approx_locate(scan, end, scan->score);
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/*
+ * Set up a scan
+ */
+static ApproxScan *
+approx_begin(const dna *d, const dna *needle, int max_errors, bool edit)
+{
+    ApproxScan *scan = palloc0(sizeof(ApproxScan));
+    uint32 len = needle->length;
+    int nwords;
+    
+    scan->needle = palloc(Max(len, 1));
+    dna_unpack(needle, 0, len, scan->needle);
+    dna_pattern_init(&scan->pattern, scan->needle, len);
+    nwords = scan->pattern.nwords;
+    
+    scan->d = d;
+    dna_cursor_init(&scan->cur, d);
+    scan->edit = edit;
+    scan->max_errors = Min(max_errors, (int) len);
+    scan->pos = 0;
+    
+    if (edit)
+    {
+        /* Column 0 is 0, 1, 2, ...: all vertical deltas are +1 */
+        scan->state = palloc(2 * nwords * sizeof(uint64));
+        memset(scan->state, 0xFF, nwords * sizeof(uint64));
+        memset(scan->state + nwords, 0, nwords * sizeof(uint64));
+        scan->score = len;
+        scan->column = palloc((len + 1) * sizeof(int32));
+        scan->window = palloc(len + scan->max_errors);
+    }
+    else
+        scan->state = palloc0((scan->max_errors + 1) * nwords * sizeof(uint64));
+    
+    return scan;
+}
+
+/*
+ * Find approximate occurrences of a needle
+ *
+ * Returns (position, length, distance) for every match end with at most
+ * max_errors errors: mismatches in 'hamming' mode, or insertions, deletions
+ * and mismatches in 'edit' mode, where neighbouring ends of one occurrence
+ * each give a row.  IUPAC codes match the bases they stand for.
+ */
+PG_FUNCTION_INFO_V1(dna_find_approx);
+Datum
+dna_find_approx(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    ApproxScan *scan;
+    Datum values[3];
+    bool nulls[3] = {false, false, false};
+    
+    if (SRF_IS_FIRSTCALL())
+    {
+        MemoryContext oldcontext;
+        TupleDesc tupdesc;
+        dna *needle;
+        int max_errors = PG_GETARG_INT32(2);
+        const char *mode = PG_NARGS() > 3 ? text_to_cstring(PG_GETARG_TEXT_PP(3)) : "edit";
+        bool edit;
+        
+        if (pg_strcasecmp(mode, "edit") == 0)
+            edit = true;
+        else if (pg_strcasecmp(mode, "hamming") == 0)
+            edit = false;
+        else
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("invalid approximate search mode: \"%s\"", mode),
+                     errhint("Valid modes are \"edit\" and \"hamming\".")));
+        
+        if (max_errors < 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("max_errors must not be negative")));
+        
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+        
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("function returning record called in context that cannot accept type record")));
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+        
+        needle = PG_GETARG_DNA_P(1);
+        if (needle->length == 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("needle cannot be empty")));
+        
+        funcctx->user_fctx = approx_begin(PG_GETARG_DNA_P(0), needle,
+                                          max_errors, edit);
+        
+        MemoryContextSwitchTo(oldcontext);
+    }
+    
+    funcctx = SRF_PERCALL_SETUP();
+    scan = (ApproxScan *) funcctx->user_fctx;
+    
+    if (!approx_next(scan))
+        SRF_RETURN_DONE(funcctx);
+    
+    values[0] = Int32GetDatum(scan->start);
+    values[1] = Int32GetDatum(scan->length);
+    values[2] = Int32GetDatum(scan->distance);
+    
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(funcctx->tuple_desc,
+                                                               values, nulls)));
+}
+
+/*
+ * Edit distance of two base arrays within a band of max diagonals
+ * Returns max + 1 as soon as every cell of a row exceeds max.
+ */
+static int32
+edit_distance_banded(const char *a, uint32 len_a, const char *b, uint32 len_b,
+                     int32 max)
+{
+    int32 big = max + 1;
+    int32 *row;
+    int32 result;
+    uint32 i;
+    uint32 j;
+    
+    if ((len_a > len_b ? len_a - len_b : len_b - len_a) > (uint32) max)
+        return big;
+    
+    /* row[j]: distance of the first i bases of a to the first j of b */
+    row = palloc((len_b + 1) * sizeof(int32));
+    for (j = 0; j <= len_b; j++)
+        row[j] = j <= (uint32) max ? (int32) j : big;
+    
+    for (i = 1; i <= len_a; i++)
+    {
+        uint32 lo = i > (uint32) max ? i - max : 1;
+        uint32 hi = Min(len_b, i + max);
+        int32 diag = row[lo - 1];
+        int32 row_min;
+        
+        /* Cells left of the band are out of reach */
+        row[lo - 1] = lo == 1 ? Min((int32) i, big) : big;
+        row_min = row[lo - 1];
+        
+        for (j = lo; j <= hi; j++)
+        {
+            int32 up = row[j];
+            int32 value = diag + (a[i - 1] != b[j - 1]);
+            
+            value = Min(value, Min(up, row[j - 1]) + 1);
+            diag = up;
+            row[j] = Min(value, big);
+            row_min = Min(row_min, row[j]);
+        }
+        
+        if (row_min > max)
+        {
+            pfree(row);
+            return big;
+        }
+    }
+    
+    result = row[len_b];
+    pfree(row);
+    
+    return result;
+}
+
+/*
+ * Edit distance of two base arrays
+ *
+ * With max >= 0, returns max + 1 once the distance is known to exceed max,
+ * after O(max * n) work at most.  With max < 0 the exact distance is
+ * computed by doubling the band until it holds the distance (Ukkonen), so
+ * similar sequences cost O(d * n) rather than O(n^2).
+ */
+int32
+dna_edit_distance_bases(const char *a, uint32 len_a, const char *b, uint32 len_b,
+                        int32 max)
+{
+    uint32 longest = Max(len_a, len_b);
+    uint32 band;
+    int32 result;
+    
+    if (max >= 0)
+        return edit_distance_banded(a, len_a, b, len_b, Min((uint32) max, longest));
+    
+    band = Max(longest - Min(len_a, len_b), 16);
+    for (;;)
+    {
+        band = Min(band, longest);
+        result = edit_distance_banded(a, len_a, b, len_b, band);
+        if (result <= (int32) band)
+            return result;
+        band *= 2;
+    }
+}
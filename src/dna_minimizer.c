@@ -0,0 +1,296 @@
+#include "dna.h"
+#include "funcapi.h"
+
+/*
+ * Minimizers and syncmers
+ *
+ * Both select a subset of the k-mers of a sequence from their canonical
+ * ntHash values (see dna_hash_scan_next), so a k-mer and its reverse
+ * complement are selected alike and the reported hashes join with
+ * dna_kmer_hashes(seq, k, true).
+ *
+ * A minimizer is the k-mer of smallest hash among w consecutive k-mers,
+ * the leftmost one on ties; each is reported once however many windows
+ * select it.  A closed syncmer is a k-mer whose smallest s-mer, by the
+ * same canonical hash, is its first or last one, which depends on the
+ * k-mer alone and not on its neighbours.
+ *
+ * The sliding minimum is kept in a monotone deque: entries are ordered by
+ * position with strictly increasing hashes, an entry being dropped from
+ * the back as soon as a smaller hash arrives and from the front once it
+ * leaves the window.  Each hash is pushed and dropped at most once, so a
+ * sequence is processed in linear time whatever the window size.  Windows
+ * never span an ambiguity code or gap.
+ */
+
+typedef struct
+{
+    uint32 position;
+    uint64 hash;
+    bool reverse;       /* The reverse complement hashes lower */
+} MinimizerEntry;
+
+typedef struct
+{
+    MinimizerEntry *entries;    /* Ring buffer of capacity slots */
+    int32 capacity;
+    int32 head;         /* Slot of the front entry */
+    int32 count;
+} MinimizerDeque;
+
+typedef struct
+{
+    DnaHashScan kmers;  /* Canonical hashes of the k-mers */
+    DnaHashScan smers;  /* Canonical hashes of the s-mers, syncmers only */
+    int32 window;       /* w, or k - s + 1 s-mers per k-mer */
+    MinimizerDeque deque;
+    int64 last;         /* Last k-mer position read, or last s-mer pushed */
+    int32 run;          /* Consecutive k-mers ending at last */
+    int64 reported;     /* Position of the last minimizer returned */
+    MinimizerEntry selected;    /* K-mer to return */
+} MinimizerScan;
+
+static inline MinimizerEntry *
+deque_front(MinimizerDeque *deque)
+{
+    return &deque->entries[deque->head];
+}
+
+static inline MinimizerEntry *
+deque_back(MinimizerDeque *deque)
+{
+    return &deque->entries[(deque->head + deque->count - 1) % deque->capacity];
+}
+
+/*
+ * Drop the entries before a position from the front
+ */
+static inline void
+deque_expire(MinimizerDeque *deque, int64 first)
+{
+    while (deque->count > 0 && (int64) deque_front(deque)->position < first)
+    {
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+    }
+}
+
+/*
+ * Append a hash, dropping the larger ones it hides from the back
+ * The caller expires entries first so that the deque never overflows.
+ */
+static inline void
+deque_push(MinimizerDeque *deque, uint32 position, uint64 hash, bool reverse)
+{
+    MinimizerEntry *entry;
+    
+    while (deque->count > 0 && deque_back(deque)->hash > hash)
+        deque->count--;
+    
+    Assert(deque->count < deque->capacity);
+    deque->count++;
+    entry = deque_back(deque);
+    entry->position = position;
+    entry->hash = hash;
+    entry->reverse = reverse;
+}
+
+/*
+ * Start selecting the k-mers of a detoasted sequence
+ * param is s for syncmers and w for minimizers.
+ */
+static MinimizerScan *
+minimizer_begin(const dna *d, int32 k, int32 param, bool syncmers)
+{
+    MinimizerScan *scan = palloc0(sizeof(MinimizerScan));
+    
+    scan->window = syncmers ? k - param + 1 : param;
+    scan->last = -1;
+    scan->reported = -1;
+    
+    /*
+     * The deque never holds more entries than a window has positions, nor
+     * more than the sequence has, so a huge w costs nothing on short input.
+     */
+    scan->deque.capacity = Max(Min((uint32) scan->window, d->length), 1);
+    scan->deque.entries = palloc(scan->deque.capacity * sizeof(MinimizerEntry));
+    
+    dna_hash_scan_init(&scan->kmers, d, k, true);
+    if (syncmers)
+        dna_hash_scan_init(&scan->smers, d, param, true);
+    
+    return scan;
+}
+
+/*
+ * Find the next minimizer
+ */
+static bool
+minimizer_next(MinimizerScan *scan)
+{
+    MinimizerDeque *deque = &scan->deque;
+    uint32 position;
+    uint64 hash;
+    
+    while (dna_hash_scan_next(&scan->kmers, &position, &hash))
+    {
+        MinimizerEntry *front;
+        
+        /* A skipped window breaks the run */
+        if ((int64) position != scan->last + 1)
+        {
+            deque->count = 0;
+            scan->run = 0;
+        }
+        scan->last = position;
+        scan->run++;
+        
+        deque_expire(deque, (int64) position - scan->window + 1);
+        deque_push(deque, position, hash,
+                   scan->kmers.reverse < scan->kmers.forward);
+        
+        if (scan->run < scan->window)
+            continue;
+        
+        front = deque_front(deque);
+        if ((int64) front->position == scan->reported)
+            continue;
+        
+        scan->reported = front->position;
+        scan->selected = *front;
+        return true;
+    }
+    
+    return false;
+}
+
+/*
+ * Find the next closed syncmer
+ */
+static bool
+syncmer_next(MinimizerScan *scan)
+{
+    MinimizerDeque *deque = &scan->deque;
+    int32 span = scan->window - 1;
+    uint32 position;
+    uint64 hash;
+    
+    while (dna_hash_scan_next(&scan->kmers, &position, &hash))
+    {
+        uint32 smer_position;
+        uint64 smer_hash;
+        
+        /*
+         * The s-mers of an unambiguous k-mer are all unambiguous, so the
+         * s-mer scan reaches the last one exactly.
+         */
+        while (scan->last < (int64) position + span &&
+               dna_hash_scan_next(&scan->smers, &smer_position, &smer_hash))
+        {
+            deque_expire(deque, (int64) smer_position - span);
+            deque_push(deque, smer_position, smer_hash, false);
+            scan->last = smer_position;
+        }
+        deque_expire(deque, position);
+        
+        if (deque_front(deque)->position == position ||
+            deque_back(deque)->hash == deque_front(deque)->hash)
+        {
+            scan->selected.position = position;
+            scan->selected.hash = hash;
+            scan->selected.reverse = scan->kmers.reverse < scan->kmers.forward;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/*
+ * Shared body of dna_minimizers and dna_syncmers
+ * Returns (position, hash, strand) rows, one k-mer per call.
+ */
+static Datum
+minimizer_srf(FunctionCallInfo fcinfo, bool syncmers)
+{
+    FuncCallContext *funcctx;
+    MinimizerScan *scan;
+    Datum values[3];
+    bool nulls[3] = {false, false, false};
+    bool found;
+    
+    if (SRF_IS_FIRSTCALL())
+    {
+        MemoryContext oldcontext;
+        TupleDesc tupdesc;
+        int32 k = PG_GETARG_INT32(1);
+        int32 param = PG_GETARG_INT32(2);
+        
+        if (k <= 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("k must be positive")));
+        if (syncmers && (param <= 0 || param > k))
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("s must be between 1 and k")));
+        if (!syncmers && param <= 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("window must be positive")));
+        
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+        
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("function returning record called in context that cannot accept type record")));
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+        
+        /* The detoasted value must outlive the first call */
+        funcctx->user_fctx = minimizer_begin(PG_GETARG_DNA_P(0), k, param, syncmers);
+        
+        MemoryContextSwitchTo(oldcontext);
+    }
+    
+    funcctx = SRF_PERCALL_SETUP();
+    scan = (MinimizerScan *) funcctx->user_fctx;
+    
+    found = syncmers ? syncmer_next(scan) : minimizer_next(scan);
+    if (!found)
+        SRF_RETURN_DONE(funcctx);
+    
+    values[0] = Int32GetDatum(scan->selected.position);
+    values[1] = Int64GetDatum((int64) scan->selected.hash);
+    values[2] = CharGetDatum(scan->selected.reverse ? '-' : '+');
+    
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(funcctx->tuple_desc,
+                                                               values, nulls)));
+}
+
+/*
+ * Minimizers of a DNA sequence
+ * Returns (position, hash, strand) for the k-mer of smallest canonical hash
+ * of every window of w consecutive unambiguous k-mers, each k-mer once.
+ * strand is '-' when the reverse complement of the k-mer hashes lower
+ * than the k-mer itself.
+ */
+PG_FUNCTION_INFO_V1(dna_minimizers);
+Datum
+dna_minimizers(PG_FUNCTION_ARGS)
+{
+    return minimizer_srf(fcinfo, false);
+}
+
+/*
+ * Closed syncmers of a DNA sequence
+ * Returns (position, hash, strand) like dna_minimizers for every
+ * unambiguous k-mer whose smallest s-mer is its first or last one.
+ */
+PG_FUNCTION_INFO_V1(dna_syncmers);
+Datum
+dna_syncmers(PG_FUNCTION_ARGS)
+{
+    return minimizer_srf(fcinfo, true);
+}
@@ -0,0 +1,342 @@
+#include "dna.h"
+#include <string.h>
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
+
+/*
+ * Multi-pattern search with an Aho-Corasick automaton
+ *
+ * Every pattern of a panel, and optionally its reverse complement, goes
+ * into one trie whose failure links are folded into a full transition
+ * table over the 16 sequence symbols.  A read is then scanned once, with
+ * one table lookup per base, however many patterns the panel holds.
+ *
+ * The automaton is built once per call site and kept in fn_extra for as
+ * long as the pattern array does not change.  Because fn_extra is taken,
+ * dna_match_any returns its rows in materialize mode rather than through
+ * the value-per-call SRF protocol.
+ */
+
+/* State of the automaton */
+typedef struct
+{
+    int32 next[DNA_NSYMBOLS];   /* Transitions, failure links folded in */
+    int32 fail;         /* State of the longest proper suffix */
+    int32 output;       /* Nearest state on the failure chain ending a pattern, or 0 */
+    int32 first;        /* First pattern ending in this state, or -1 */
+} AcState;
+
+/* Pattern recognized by the automaton */
+typedef struct
+{
+    int32 index;        /* Subscript in the pattern array */
+    int32 length;       /* Number of bases */
+    bool reverse;       /* Reverse complement of the array element */
+    int32 next;         /* Next pattern ending in the same state, or -1 */
+} AcPattern;
+
+typedef struct
+{
+    MemoryContext context;      /* Holds everything below */
+    ArrayType *key;     /* Copy of the pattern array */
+    bool both_strands;  /* Whether reverse complements were added */
+    AcState *states;
+    int32 nstates;
+    int32 maxstates;
+    AcPattern *patterns;
+    int32 npatterns;
+    int32 maxpatterns;
+    uint8 symbol[256];  /* Position of each symbol in DNA_SYMBOLS */
+} AcAutomaton;
+
+/*
+ * Append an empty state
+ */
+static int32
+ac_new_state(AcAutomaton *ac)
+{
+    AcState *state;
+    
+    if (ac->nstates == ac->maxstates)
+    {
+        ac->maxstates *= 2;
+        ac->states = repalloc(ac->states, ac->maxstates * sizeof(AcState));
+    }
+    
+    state = &ac->states[ac->nstates];
+    memset(state->next, 0, sizeof(state->next));
+    state->fail = 0;
+    state->output = 0;
+    state->first = -1;
+    
+    return ac->nstates++;
+}
+
+/*
+ * Add a pattern to the trie
+ */
+static void
+ac_add_pattern(AcAutomaton *ac, const char *bases, int32 len,
+               int32 index, bool reverse)
+{
+    AcPattern *pattern;
+    int32 state = 0;
+    int32 i;
+    
+    for (i = 0; i < len; i++)
+    {
+        int sym = ac->symbol[(uint8) bases[i]];
+        
+        /* State 0 is the root, so it never is a child */
+        if (ac->states[state].next[sym] == 0)
+        {
+            int32 child = ac_new_state(ac);
+            
+            ac->states[state].next[sym] = child;
+        }
+        state = ac->states[state].next[sym];
+    }
+    
+    if (ac->npatterns == ac->maxpatterns)
+    {
+        ac->maxpatterns *= 2;
+        ac->patterns = repalloc(ac->patterns, ac->maxpatterns * sizeof(AcPattern));
+    }
+    
+    pattern = &ac->patterns[ac->npatterns];
+    pattern->index = index;
+    pattern->length = len;
+    pattern->reverse = reverse;
+    pattern->next = ac->states[state].first;
+    ac->states[state].first = ac->npatterns++;
+}
+
+/*
+ * Compute failure links breadth-first and fold them into the transitions
+ */
+static void
+ac_finish(AcAutomaton *ac)
+{
+    int32 *queue = palloc(ac->nstates * sizeof(int32));
+    int32 head = 0;
+    int32 tail = 0;
+    int sym;
+    
+    for (sym = 0; sym < DNA_NSYMBOLS; sym++)
+    {
+        int32 child = ac->states[0].next[sym];
+        
+        if (child != 0)
+            queue[tail++] = child;
+    }
+    
+    while (head < tail)
+    {
+        int32 s = queue[head++];
+        AcState *state = &ac->states[s];
+        const AcState *fail = &ac->states[state->fail];
+        
+        state->output = state->first >= 0 ? s : fail->output;
+        
+        for (sym = 0; sym < DNA_NSYMBOLS; sym++)
+        {
+            int32 child = state->next[sym];
+            
+            if (child != 0)
+            {
+                ac->states[child].fail = fail->next[sym];
+                queue[tail++] = child;
+            }
+            else
+                state->next[sym] = fail->next[sym];
+        }
+    }
+    
+    pfree(queue);
+}
+
+/*
+ * Build the automaton for a pattern array
+ */
+static AcAutomaton *
+ac_build(MemoryContext parent, ArrayType *patterns, bool both_strands)
+{
+    MemoryContext context;
+    MemoryContext oldcontext;
+    AcAutomaton *ac;
+    Datum *elems;
+    bool *nulls;
+    int nelems;
+    int16 typlen;
+    bool typbyval;
+    char typalign;
+    int lbound;
+    int i;
+    
+    context = AllocSetContextCreate(parent, "dna_match_any automaton",
+                                    ALLOCSET_SMALL_SIZES);
+    oldcontext = MemoryContextSwitchTo(context);
+    
+    ac = palloc0(sizeof(AcAutomaton));
+    ac->context = context;
+    ac->key = (ArrayType *) palloc(VARSIZE(patterns));
+    memcpy(ac->key, patterns, VARSIZE(patterns));
+    ac->both_strands = both_strands;
+    
+    for (i = 0; i < DNA_NSYMBOLS; i++)
+        ac->symbol[(uint8) DNA_SYMBOLS[i]] = i;
+    
+    ac->maxstates = 64;
+    ac->states = palloc(ac->maxstates * sizeof(AcState));
+    ac->maxpatterns = 16;
+    ac->patterns = palloc(ac->maxpatterns * sizeof(AcPattern));
+    ac_new_state(ac);
+    
+    get_typlenbyvalalign(ARR_ELEMTYPE(patterns), &typlen, &typbyval, &typalign);
+    deconstruct_array(patterns, ARR_ELEMTYPE(patterns), typlen, typbyval,
+                      typalign, &elems, &nulls, &nelems);
+    lbound = ARR_NDIM(patterns) > 0 ? ARR_LBOUND(patterns)[0] : 1;
+    
+    for (i = 0; i < nelems; i++)
+    {
+        DnaView view;
+        char *rc;
+        uint32 j;
+        
+        /* NULL and empty patterns never match */
+        if (nulls[i])
+            continue;
+        view = dna_get_view(elems[i]);
+        if (view.length == 0)
+            continue;
+        
+        ac_add_pattern(ac, view.bases, view.length, lbound + i, false);
+        
+        if (both_strands)
+        {
+            rc = palloc(view.length);
+            for (j = 0; j < view.length; j++)
+                rc[j] = complement_map[(uint8) view.bases[view.length - 1 - j]];
+            ac_add_pattern(ac, rc, view.length, lbound + i, true);
+            pfree(rc);
+        }
+        
+        dna_release_view(&view);
+    }
+    
+    pfree(elems);
+    pfree(nulls);
+    
+    ac_finish(ac);
+    
+    MemoryContextSwitchTo(oldcontext);
+    
+    return ac;
+}
+
+/*
+ * Get the automaton of a call site, rebuilding it if the patterns changed
+ */
+static const AcAutomaton *
+ac_get(FmgrInfo *flinfo, ArrayType *patterns, bool both_strands)
+{
+    AcAutomaton *ac = (AcAutomaton *) flinfo->fn_extra;
+    
+    if (ac != NULL && ac->both_strands == both_strands &&
+        VARSIZE(ac->key) == VARSIZE(patterns) &&
+        memcmp(ac->key, patterns, VARSIZE(patterns)) == 0)
+        return ac;
+    
+    if (ac != NULL)
+        MemoryContextDelete(ac->context);
+    
+    ac = ac_build(flinfo->fn_mcxt, patterns, both_strands);
+    flinfo->fn_extra = ac;
+    
+    return ac;
+}
+
+/*
+ * Find every occurrence of any pattern of an array
+ *
+ * Returns (pattern, position, strand) rows ordered by end position, where
+ * pattern is the array subscript, position the 0-based start of the match
+ * on the sequence, and strand '-' for a match of the reverse complement of
+ * the pattern.  NULL and empty patterns are ignored.
+ */
+PG_FUNCTION_INFO_V1(dna_match_any);
+Datum
+dna_match_any(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    dna *d = PG_GETARG_DNA_P(0);
+    ArrayType *patterns = PG_GETARG_ARRAYTYPE_P(1);
+    bool both_strands = PG_NARGS() > 2 ? PG_GETARG_BOOL(2) : false;
+    const AcAutomaton *ac;
+    Tuplestorestate *tupstore;
+    TupleDesc tupdesc;
+    MemoryContext oldcontext;
+    DnaCursor *cur;
+    int32 state = 0;
+    uint32 i;
+    
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+        (rsinfo->allowedModes & SFRM_Materialize) == 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("materialize mode required, but it is not allowed in this context")));
+    
+    if (ARR_NDIM(patterns) > 1)
+        ereport(ERROR,
+                (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                 errmsg("pattern array must be one-dimensional")));
+    
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("function returning record called in context that cannot accept type record")));
+    
+    ac = ac_get(fcinfo->flinfo, patterns, both_strands);
+    
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupdesc = CreateTupleDescCopy(tupdesc);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+    
+    cur = palloc(sizeof(DnaCursor));
+    dna_cursor_init(cur, d);
+    
+    for (i = 0; i < d->length; i++)
+    {
+        int32 out;
+        
+        state = ac->states[state].next[ac->symbol[(uint8) dna_cursor_base(cur, i)]];
+        
+        for (out = ac->states[state].output; out != 0;
+             out = ac->states[ac->states[out].fail].output)
+        {
+            int32 p;
+            
+            for (p = ac->states[out].first; p >= 0; p = ac->patterns[p].next)
+            {
+                const AcPattern *pattern = &ac->patterns[p];
+                Datum values[3];
+                bool nulls[3] = {false, false, false};
+                
+                values[0] = Int32GetDatum(pattern->index);
+                values[1] = Int32GetDatum(i + 1 - pattern->length);
+                values[2] = CharGetDatum(pattern->reverse ? '-' : '+');
+                tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+            }
+        }
+    }
+    
+    pfree(cur);
+    
+    return (Datum) 0;
+}
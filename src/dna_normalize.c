@@ -0,0 +1,130 @@
+#include "dna.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Validation and normalization of nucleotide input
+ *
+ * Every input path (dna_in, dna_recv, string_to_dna, kmer_in, qkmer_in)
+ * goes through dna_normalize, which checks and uppercases a sequence in a
+ * single pass.  Blocks made only of A/C/G/T/N and gaps, in either case,
+ * are handled 16 or 32 bytes at a time with SSE2 or AVX2 when the compiler
+ * targets them; any other block falls back to the lookup table.
+ */
+
+/*
+ * Scalar validation of symbols [from, to) using the lookup table
+ */
+static inline int
+normalize_scalar(const char *src, char *dst, int from, int to)
+{
+    int i;
+    
+    for (i = from; i < to; i++)
+    {
+        char c = nucleotide_normalize_map[(uint8) src[i]];
+        
+        if (c == 0)
+            return i;
+        dst[i] = c;
+    }
+    
+    return -1;
+}
+
+/*
+ * Validate and uppercase len symbols of src into dst
+ * dst may be the same buffer as src.  Returns the position of the first
+ * invalid symbol, or -1 if the whole sequence is valid.
+ */
+int
+dna_normalize(const char *src, char *dst, int len)
+{
+    int i = 0;
+    
+#if defined(__AVX2__)
+    const __m256i case_mask = _mm256_set1_epi8((char) 0xDF);
+    const __m256i gap_bit = _mm256_set1_epi8(0x20);
+    const __m256i upper_a = _mm256_set1_epi8('A');
+    const __m256i upper_c = _mm256_set1_epi8('C');
+    const __m256i upper_g = _mm256_set1_epi8('G');
+    const __m256i upper_t = _mm256_set1_epi8('T');
+    const __m256i upper_n = _mm256_set1_epi8('N');
+    const __m256i gap = _mm256_set1_epi8('-');
+    
+    while (i + 32 <= len)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i upper = _mm256_and_si256(v, case_mask);
+        __m256i is_gap = _mm256_cmpeq_epi8(v, gap);
+        __m256i ok;
+        
+        ok = _mm256_or_si256(_mm256_cmpeq_epi8(upper, upper_a),
+                             _mm256_cmpeq_epi8(upper, upper_c));
+        ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(upper, upper_g));
+        ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(upper, upper_t));
+        ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(upper, upper_n));
+        ok = _mm256_or_si256(ok, is_gap);
+        
+        if (_mm256_movemask_epi8(ok) != -1)
+        {
+            int bad = normalize_scalar(src, dst, i, i + 32);
+            
+            if (bad >= 0)
+                return bad;
+            i += 32;
+            continue;
+        }
+        
+        /* Clearing the case bit also clears it in '-', so restore it */
+        upper = _mm256_or_si256(upper, _mm256_and_si256(is_gap, gap_bit));
+        _mm256_storeu_si256((__m256i *) (dst + i), upper);
+        i += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i case_mask = _mm_set1_epi8((char) 0xDF);
+    const __m128i gap_bit = _mm_set1_epi8(0x20);
+    const __m128i upper_a = _mm_set1_epi8('A');
+    const __m128i upper_c = _mm_set1_epi8('C');
+    const __m128i upper_g = _mm_set1_epi8('G');
+    const __m128i upper_t = _mm_set1_epi8('T');
+    const __m128i upper_n = _mm_set1_epi8('N');
+    const __m128i gap = _mm_set1_epi8('-');
+    
+    while (i + 16 <= len)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i upper = _mm_and_si128(v, case_mask);
+        __m128i is_gap = _mm_cmpeq_epi8(v, gap);
+        __m128i ok;
+        
+        ok = _mm_or_si128(_mm_cmpeq_epi8(upper, upper_a),
+                          _mm_cmpeq_epi8(upper, upper_c));
+        ok = _mm_or_si128(ok, _mm_cmpeq_epi8(upper, upper_g));
+        ok = _mm_or_si128(ok, _mm_cmpeq_epi8(upper, upper_t));
+        ok = _mm_or_si128(ok, _mm_cmpeq_epi8(upper, upper_n));
+        ok = _mm_or_si128(ok, is_gap);
+        
+        if (_mm_movemask_epi8(ok) != 0xFFFF)
+        {
+            int bad = normalize_scalar(src, dst, i, i + 16);
+            
+            if (bad >= 0)
+                return bad;
+            i += 16;
+            continue;
+        }
+        
+        /* Clearing the case bit also clears it in '-', so restore it */
+        upper = _mm_or_si128(upper, _mm_and_si128(is_gap, gap_bit));
+        _mm_storeu_si128((__m128i *) (dst + i), upper);
+        i += 16;
+    }
+#endif
+    
+    return normalize_scalar(src, dst, i, len);
+}
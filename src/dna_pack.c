@@ -0,0 +1,431 @@
+#include "dna.h"
+#include <string.h>
+#include "port/pg_bitutils.h"
+
+/*
+ * 2-bit packed storage for the DNA type
+ *
+ * A/C/G/T are stored as codes 0-3, four bases per byte with the first base
+ * in the two high bits.  Since A < C < G < T in ASCII as well, comparing
+ * packed bytes orders sequences the same way as comparing their text.
+ * Ambiguity codes and gaps live in a side list of runs; their slots in the
+ * packed bytes are left zero so that the representation stays canonical.
+ */
+
+/* 2-bit code plus one for A/C/G/T, zero for anything else */
+static const uint8 pack_code[256] = {
+    ['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4
+};
+
+static const char pack_base[4] = { 'A', 'C', 'G', 'T' };
+
+/* Index into DNA_SYMBOLS plus one, zero for anything else */
+static const uint8 symbol_code[256] = {
+    ['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4,
+    ['R'] = 5, ['Y'] = 6, ['S'] = 7, ['W'] = 8,
+    ['K'] = 9, ['M'] = 10, ['B'] = 11, ['D'] = 12,
+    ['H'] = 13, ['V'] = 14, ['N'] = 15, ['-'] = 16
+};
+
+#define PACK_SHIFT(i)   (6 - 2 * ((i) & 3))
+
+/*
+ * Count the runs of non-ACGT symbols in a sequence
+ */
+static uint32
+count_runs(const char *bases, uint32 len)
+{
+    uint32 nruns = 0;
+    char prev = 0;
+    uint32 i;
+    
+    for (i = 0; i < len; i++)
+    {
+        char c = bases[i];
+        
+        if (pack_code[(uint8) c] == 0)
+        {
+            if (c != prev)
+                nruns++;
+            prev = c;
+        }
+        else
+            prev = 0;
+    }
+    
+    return nruns;
+}
+
+/*
+ * Get the position of a symbol in DNA_SYMBOLS, or -1
+ */
+int
+dna_symbol_index(char c)
+{
+    return (int) symbol_code[(uint8) c] - 1;
+}
+
+/*
+ * Compute the summary of validated, uppercase bases
+ */
+static void
+dna_summarize(const char *bases, uint32 len, DnaSummary *summary)
+{
+    uint32 i;
+    
+    memset(summary, 0, sizeof(DnaSummary));
+    
+    for (i = 0; i < len; i++)
+        summary->counts[symbol_code[(uint8) bases[i]] - 1]++;
+    
+    if (summary->counts[0] + summary->counts[1] +
+        summary->counts[2] + summary->counts[3] == len)
+        summary->flags |= DNA_SUMMARY_ONLY_ACGT;
+    
+    /*
+     * Compare the sequence with its reverse complement up to the first
+     * difference, which decides both flags
+     */
+    for (i = 0; i < len; i++)
+    {
+        char rc = complement_nucleotide(bases[len - 1 - i]);
+        
+        if (bases[i] != rc)
+        {
+            if (i >= len / 2)
+                summary->flags |= DNA_SUMMARY_PALINDROME;
+            if (bases[i] < rc)
+                summary->flags |= DNA_SUMMARY_CANONICAL;
+            return;
+        }
+    }
+    
+    summary->flags |= DNA_SUMMARY_PALINDROME | DNA_SUMMARY_CANONICAL;
+}
+
+/*
+ * Pack validated, uppercase bases into a zeroed packed payload
+ */
+static void
+dna_pack(const char *bases, uint32 len, uint32 nruns, char *body)
+{
+    DnaRun *runs;
+    uint8 *bits;
+    uint32 r = 0;
+    uint32 i;
+    
+    *(uint32 *) body = nruns;
+    
+    runs = (DnaRun *) (body + sizeof(uint32));
+    bits = (uint8 *) (runs + nruns);
+    
+    for (i = 0; i < len; i++)
+    {
+        uint8 code;
+        
+        /* Fast path: four unambiguous bases filling a whole byte */
+        if ((i & 3) == 0 && i + 4 <= len)
+        {
+            uint8 c0 = pack_code[(uint8) bases[i]];
+            uint8 c1 = pack_code[(uint8) bases[i + 1]];
+            uint8 c2 = pack_code[(uint8) bases[i + 2]];
+            uint8 c3 = pack_code[(uint8) bases[i + 3]];
+            
+            if (c0 && c1 && c2 && c3)
+            {
+                bits[i >> 2] = ((c0 - 1) << 6) | ((c1 - 1) << 4) |
+                               ((c2 - 1) << 2) | (c3 - 1);
+                i += 3;
+                continue;
+            }
+        }
+        
+        code = pack_code[(uint8) bases[i]];
+        if (code != 0)
+        {
+            bits[i >> 2] |= (code - 1) << PACK_SHIFT(i);
+        }
+        else if (r > 0 && runs[r - 1].code == bases[i] &&
+                 runs[r - 1].start + runs[r - 1].len == i)
+        {
+            runs[r - 1].len++;
+        }
+        else
+        {
+            runs[r].start = i;
+            runs[r].len = 1;
+            runs[r].code = bases[i];
+            r++;
+        }
+    }
+    
+    Assert(r == nruns);
+}
+
+/*
+ * Build a DNA value from validated, uppercase bases
+ *
+ * The packed layout is used whenever it is smaller than the plain one, and
+ * long sequences get a summary of their composition.
+ */
+dna *
+dna_make(const char *bases, uint32 len)
+{
+    uint32 nruns = count_runs(bases, len);
+    Size packed_size = sizeof(uint32) + nruns * sizeof(DnaRun) +
+                       DNA_PACKED_NBYTES(len);
+    uint32 flags = 0;
+    Size size;
+    dna *result;
+    
+    if (len >= DNA_SUMMARY_MIN_LENGTH)
+        flags |= DNA_FLAG_SUMMARY;
+    if (packed_size < len)
+        flags |= DNA_FLAG_PACKED;
+    
+    size = DNA_HDRSZ + DNA_BODY_OFFSET(flags) +
+           ((flags & DNA_FLAG_PACKED) ? packed_size : len);
+    
+    result = (dna *) palloc0(size);
+    SET_VARSIZE(result, size);
+    result->length = len;
+    result->flags = flags;
+    
+    if (flags & DNA_FLAG_SUMMARY)
+        dna_summarize(bases, len, (DnaSummary *) result->data);
+    
+    if (flags & DNA_FLAG_PACKED)
+        dna_pack(bases, len, nruns, (char *) DNA_BODY(result));
+    else
+        memcpy((char *) DNA_BODY(result), bases, len);
+    
+    return result;
+}
+
+/*
+ * Decode bases [start, start + count) of a packed sequence into out
+ *
+ * bits holds the packed bytes from base bits_origin onwards, which must be
+ * a multiple of four; runs is the complete run list of the sequence.
+ */
+void
+dna_unpack_packed(const uint8 *bits, uint32 bits_origin,
+                  const DnaRun *runs, uint32 nruns,
+                  uint32 start, uint32 count, char *out)
+{
+    uint32 end = start + count;
+    uint32 lo, hi;
+    uint32 i = start;
+    char *p = out;
+    
+    Assert((bits_origin & 3) == 0 && bits_origin <= start);
+    bits -= bits_origin / 4;
+    
+    while (i < end && (i & 3) != 0)
+    {
+        *p++ = pack_base[(bits[i >> 2] >> PACK_SHIFT(i)) & 3];
+        i++;
+    }
+    
+    while (i + 4 <= end)
+    {
+        uint8 b = bits[i >> 2];
+        
+        p[0] = pack_base[b >> 6];
+        p[1] = pack_base[(b >> 4) & 3];
+        p[2] = pack_base[(b >> 2) & 3];
+        p[3] = pack_base[b & 3];
+        p += 4;
+        i += 4;
+    }
+    
+    while (i < end)
+    {
+        *p++ = pack_base[(bits[i >> 2] >> PACK_SHIFT(i)) & 3];
+        i++;
+    }
+    
+    /* Overlay the runs intersecting the range; they are sorted by start */
+    lo = 0;
+    hi = nruns;
+    while (lo < hi)
+    {
+        uint32 mid = lo + (hi - lo) / 2;
+        
+        if (runs[mid].start + runs[mid].len <= start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    
+    for (; lo < nruns && runs[lo].start < end; lo++)
+    {
+        uint32 from = Max(runs[lo].start, start);
+        uint32 to = Min(runs[lo].start + runs[lo].len, end);
+        
+        memset(out + (from - start), runs[lo].code, to - from);
+    }
+}
+
+/*
+ * Decode bases [start, start + count) of a DNA value into out
+ */
+void
+dna_unpack(const dna *d, uint32 start, uint32 count, char *out)
+{
+    if (!DNA_IS_PACKED(d))
+    {
+        memcpy(out, DNA_BODY(d) + start, count);
+        return;
+    }
+    
+    dna_unpack_packed(DNA_PACKED_BITS(d), 0, DNA_RUNS(d), DNA_NRUNS(d),
+                      start, count, out);
+}
+
+/*
+ * Count each of DNA_SYMBOLS in a DNA value in one pass
+ *
+ * Packed values count their C/G/T codes with popcounts on 64-bit words;
+ * every other slot is either an A or covered by a run.  Plain values use a
+ * four-way byte histogram so consecutive bytes update independent
+ * counters.
+ */
+void
+dna_count_symbols(const dna *d, uint32 *counts)
+{
+    uint32 len = d->length;
+    int s;
+    
+    memset(counts, 0, DNA_NSYMBOLS * sizeof(uint32));
+    
+    if (DNA_IS_PACKED(d))
+    {
+        const uint8 *bits = DNA_PACKED_BITS(d);
+        const DnaRun *runs = DNA_RUNS(d);
+        uint32 nruns = DNA_NRUNS(d);
+        Size nbytes = DNA_PACKED_NBYTES(len);
+        uint64 ones = UINT64CONST(0x5555555555555555);
+        uint32 ncodes[4] = {0, 0, 0, 0};
+        uint32 covered = 0;
+        Size i = 0;
+        uint32 r;
+        
+        /* Padding and run slots are zero, so they never count as C/G/T */
+        for (; i + sizeof(uint64) <= nbytes; i += sizeof(uint64))
+        {
+            uint64 w;
+            
+            memcpy(&w, bits + i, sizeof(uint64));
+            ncodes[1] += pg_popcount64(w & ~(w >> 1) & ones);
+            ncodes[2] += pg_popcount64(~w & (w >> 1) & ones);
+            ncodes[3] += pg_popcount64(w & (w >> 1) & ones);
+        }
+        for (; i < nbytes; i++)
+        {
+            uint32 b = bits[i];
+            
+            ncodes[1] += pg_popcount32(b & ~(b >> 1) & 0x55);
+            ncodes[2] += pg_popcount32(~b & (b >> 1) & 0x55);
+            ncodes[3] += pg_popcount32(b & (b >> 1) & 0x55);
+        }
+        
+        for (r = 0; r < nruns; r++)
+        {
+            counts[symbol_code[(uint8) runs[r].code] - 1] += runs[r].len;
+            covered += runs[r].len;
+        }
+        
+        counts[0] = len - covered - ncodes[1] - ncodes[2] - ncodes[3];
+        counts[1] = ncodes[1];
+        counts[2] = ncodes[2];
+        counts[3] = ncodes[3];
+    }
+    else
+    {
+        const uint8 *p = (const uint8 *) DNA_BODY(d);
+        uint32 (*hist)[256] = palloc0(4 * sizeof(*hist));
+        uint32 i = 0;
+        
+        for (; i + 4 <= len; i += 4)
+        {
+            hist[0][p[i]]++;
+            hist[1][p[i + 1]]++;
+            hist[2][p[i + 2]]++;
+            hist[3][p[i + 3]]++;
+        }
+        for (; i < len; i++)
+            hist[0][p[i]]++;
+        
+        for (s = 0; s < DNA_NSYMBOLS; s++)
+        {
+            uint8 c = (uint8) DNA_SYMBOLS[s];
+            
+            counts[s] = hist[0][c] + hist[1][c] + hist[2][c] + hist[3][c];
+        }
+        
+        pfree(hist);
+    }
+}
+
+/*
+ * Set up a cursor over a detoasted DNA value
+ */
+void
+dna_cursor_init(DnaCursor *cur, const dna *d)
+{
+    cur->d = d;
+    cur->start = 0;
+    
+    if (!DNA_IS_PACKED(d))
+    {
+        cur->bases = DNA_BODY(d);
+        cur->count = d->length;
+    }
+    else
+    {
+        cur->bases = cur->buf;
+        cur->count = 0;
+    }
+}
+
+/*
+ * Decode the chunk of a packed value starting at pos
+ */
+void
+dna_cursor_fill(DnaCursor *cur, uint32 pos)
+{
+    Assert(DNA_IS_PACKED(cur->d) && pos < cur->d->length);
+    
+    cur->start = pos;
+    cur->count = Min(cur->d->length - pos, DNA_CURSOR_CHUNK);
+    dna_unpack(cur->d, pos, cur->count, cur->buf);
+}
+
+/*
+ * Compare the first nbases of two packed base arrays
+ *
+ * Only meaningful for sequences without ambiguity runs.
+ */
+int
+dna_packed_compare(const uint8 *a, const uint8 *b, uint32 nbases)
+{
+    uint32 nfull = nbases / 4;
+    uint32 i;
+    int result;
+    
+    result = memcmp(a, b, nfull);
+    if (result != 0)
+        return result;
+    
+    for (i = nfull * 4; i < nbases; i++)
+    {
+        int ca = (a[i >> 2] >> PACK_SHIFT(i)) & 3;
+        int cb = (b[i >> 2] >> PACK_SHIFT(i)) & 3;
+        
+        if (ca != cb)
+            return ca - cb;
+    }
+    
+    return 0;
+}
\ No newline at end of file
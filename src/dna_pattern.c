@@ -0,0 +1,195 @@
+#include "dna.h"
+#include <string.h>
+
+/*
+ * IUPAC-aware pattern matching
+ *
+ * A pattern base matches a sequence base when the sets of bases they stand
+ * for intersect (iupac_base_mask), so R in a pattern matches A, G, R, N and
+ * the other codes that include A or G, and an N read base matches anything.
+ * Patterns are scanned with Shift-And: one bit per pattern position, all
+ * positions advanced at once per sequence base.  Patterns of up to 64
+ * bases fit in one machine word; longer ones use one word per 64 bases.
+ */
+
+/*
+ * Compile a pattern
+ * The masks are allocated in the current memory context.
+ */
+void
+dna_pattern_init(DnaPattern *pattern, const char *bases, uint32 len)
+{
+    int sym;
+    uint32 i;
+    
+    pattern->len = len;
+    pattern->nwords = Max((len + 63) / 64, 1);
+    pattern->masks = palloc0(DNA_NSYMBOLS * pattern->nwords * sizeof(uint64));
+    
+    memset(pattern->symbol, 0, sizeof(pattern->symbol));
+    for (sym = 0; sym < DNA_NSYMBOLS; sym++)
+    {
+        uint8 mask = iupac_base_mask[(uint8) DNA_SYMBOLS[sym]];
+        uint64 *words = pattern->masks + sym * pattern->nwords;
+        
+        pattern->symbol[(uint8) DNA_SYMBOLS[sym]] = sym;
+        
+        for (i = 0; i < len; i++)
+        {
+            if ((iupac_base_mask[(uint8) bases[i]] & mask) != 0)
+                words[i / 64] |= UINT64CONST(1) << (i % 64);
+        }
+    }
+}
+
+/*
+ * Position of the first match of a pattern in a detoasted sequence, or -1
+ */
+int32
+dna_pattern_find(const DnaPattern *pattern, const dna *d)
+{
+    uint32 len = pattern->len;
+    int nwords = pattern->nwords;
+    uint64 hit = UINT64CONST(1) << ((len - 1) % 64);
+    DnaCursor *cur;
+    int32 result = -1;
+    uint32 i;
+    
+    if (len == 0)
+        return 0;
+    if (len > d->length)
+        return -1;
+    
+    cur = palloc(sizeof(DnaCursor));
+    dna_cursor_init(cur, d);
+    
+    if (nwords == 1)
+    {
+        uint64 state = 0;
+        
+        for (i = 0; i < d->length; i++)
+        {
+            int sym = pattern->symbol[(uint8) dna_cursor_base(cur, i)];
+            
+            state = ((state << 1) | 1) & pattern->masks[sym];
+            if ((state & hit) != 0)
+            {
+                result = i + 1 - len;
+                break;
+            }
+        }
+    }
+    else
+    {
+        uint64 *state = palloc0(nwords * sizeof(uint64));
+        
+        for (i = 0; i < d->length; i++)
+        {
+            int sym = pattern->symbol[(uint8) dna_cursor_base(cur, i)];
+            const uint64 *masks = pattern->masks + sym * nwords;
+            uint64 carry = 1;
+            int w;
+            
+            for (w = 0; w < nwords; w++)
+            {
+                uint64 next = (state[w] << 1) | carry;
+                
+                carry = state[w] >> 63;
+                state[w] = next & masks[w];
+            }
+            
+            if ((state[nwords - 1] & hit) != 0)
+            {
+                result = i + 1 - len;
+                break;
+            }
+        }
+        
+        pfree(state);
+    }
+    
+    pfree(cur);
+    
+    return result;
+}
+
+/*
+ * Compiled pattern kept across calls in fn_extra, like DnaSearchCache
+ */
+typedef struct
+{
+    DnaPattern pattern;
+    char *datum;        /* Copy of the pattern the state was built from */
+    Size size;          /* Size of that copy */
+} DnaPatternCache;
+
+/*
+ * Get the compiled form of a detoasted pattern, reusing the cached one
+ * when the pattern has not changed since the previous call
+ */
+const DnaPattern *
+dna_pattern_cached(FmgrInfo *flinfo, const dna *pattern)
+{
+    DnaPatternCache *cache = (DnaPatternCache *) flinfo->fn_extra;
+    Size size = VARSIZE(pattern);
+    MemoryContext oldcontext;
+    DnaView view;
+    
+    if (cache != NULL && cache->size == size &&
+        memcmp(cache->datum, pattern, size) == 0)
+        return &cache->pattern;
+    
+    if (cache == NULL)
+    {
+        cache = MemoryContextAllocZero(flinfo->fn_mcxt, sizeof(DnaPatternCache));
+        flinfo->fn_extra = cache;
+    }
+    else
+    {
+        pfree(cache->datum);
+        pfree(cache->pattern.masks);
+    }
+    
+    oldcontext = MemoryContextSwitchTo(flinfo->fn_mcxt);
+    
+    cache->datum = palloc(size);
+    memcpy(cache->datum, pattern, size);
+    cache->size = size;
+    
+    view = dna_get_view(PointerGetDatum(pattern));
+    dna_pattern_init(&cache->pattern, view.bases, view.length);
+    dna_release_view(&view);
+    
+    MemoryContextSwitchTo(oldcontext);
+    
+    return &cache->pattern;
+}
+
+/*
+ * IUPAC match operator (~@)
+ * Returns true if the right DNA sequence, read as an IUPAC pattern,
+ * matches somewhere in the left one
+ */
+PG_FUNCTION_INFO_V1(dna_iupac_match);
+Datum
+dna_iupac_match(PG_FUNCTION_ARGS)
+{
+    dna *d = PG_GETARG_DNA_P(0);
+    dna *pattern = PG_GETARG_DNA_P(1);
+    
+    PG_RETURN_BOOL(dna_pattern_find(dna_pattern_cached(fcinfo->flinfo, pattern), d) >= 0);
+}
+
+/*
+ * Find the first match of an IUPAC pattern
+ * Returns the 0-based position like dna_find_subsequence, or -1
+ */
+PG_FUNCTION_INFO_V1(dna_find_iupac);
+Datum
+dna_find_iupac(PG_FUNCTION_ARGS)
+{
+    dna *d = PG_GETARG_DNA_P(0);
+    dna *pattern = PG_GETARG_DNA_P(1);
+    
+    PG_RETURN_INT32(dna_pattern_find(dna_pattern_cached(fcinfo->flinfo, pattern), d));
+}
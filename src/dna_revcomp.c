@@ -0,0 +1,325 @@
+#include "dna.h"
+#include <string.h>
+#include "port/pg_bswap.h"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Complement, reverse and reverse complement kernels
+ *
+ * The result is written straight from the input representation.  Plain
+ * sequences go through a byte shuffle for the reversal and a lookup table
+ * for the complement, 16 bytes at a time with SSE2 or SSSE3.  Packed
+ * sequences are transformed 32 bases at a time on 64-bit words: complementing
+ * a 2-bit code is XOR 3, and reversing is a byte swap followed by a swap of
+ * the codes inside each byte.  Neither operation changes the number of
+ * ambiguity runs, so the result always keeps the layout of its input.
+ */
+
+#define PACK_SHIFT(i)           (6 - 2 * ((i) & 3))
+
+/* Number of bases decoded from each end when comparing strands */
+#define DNA_STRAND_CHUNK        64
+
+#if defined(__SSE2__)
+/*
+ * Reverse the 16 bytes of a vector
+ */
+static inline __m128i
+reverse16(__m128i v)
+{
+#if defined(__SSSE3__)
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+                                             7, 6, 5, 4, 3, 2, 1, 0));
+#else
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+#endif
+}
+
+/*
+ * Complement 16 uppercase symbols
+ * Returns false if the block needs the scalar table
+ */
+static inline bool
+complement16(__m128i v, __m128i *out)
+{
+#if defined(__SSSE3__)
+    /* Look the low nibble up in the table for letters 0x40-0x4F or 0x50-0x5F */
+    const __m128i table4 = _mm_setr_epi8(0, 'T', 'V', 'G', 'H', 0, 0, 'C',
+                                         'D', 0, 0, 'M', 0, 'K', 'N', 0);
+    const __m128i table5 = _mm_setr_epi8(0, 0, 'Y', 'S', 'A', 0, 'B', 'W',
+                                         0, 'R', 0, 0, 0, 0, 0, 0);
+    __m128i low = _mm_and_si128(v, _mm_set1_epi8(0x0F));
+    __m128i high = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+    __m128i in4 = _mm_cmpeq_epi8(high, _mm_set1_epi8(4));
+    __m128i in5 = _mm_cmpeq_epi8(high, _mm_set1_epi8(5));
+    __m128i letters;
+    
+    letters = _mm_or_si128(_mm_and_si128(in4, _mm_shuffle_epi8(table4, low)),
+                           _mm_and_si128(in5, _mm_shuffle_epi8(table5, low)));
+    
+    /* The gap is its own complement */
+    *out = _mm_or_si128(letters, _mm_andnot_si128(_mm_or_si128(in4, in5), v));
+    return true;
+#else
+    /* A^T and C^G swap the pair; N and the gap are their own complement */
+    __m128i at = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('A')),
+                              _mm_cmpeq_epi8(v, _mm_set1_epi8('T')));
+    __m128i cg = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('C')),
+                              _mm_cmpeq_epi8(v, _mm_set1_epi8('G')));
+    __m128i same = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('N')),
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+    
+    if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(at, cg), same)) != 0xFFFF)
+        return false;
+    
+    *out = _mm_xor_si128(v, _mm_or_si128(_mm_and_si128(at, _mm_set1_epi8('A' ^ 'T')),
+                                         _mm_and_si128(cg, _mm_set1_epi8('C' ^ 'G'))));
+    return true;
+#endif
+}
+#endif
+
+/*
+ * Scalar transform of output positions [from, to) of a plain sequence
+ */
+static inline void
+transform_scalar(const char *src, char *dst, uint32 len, uint32 from, uint32 to,
+                 bool reverse, bool complement)
+{
+    uint32 i;
+    
+    for (i = from; i < to; i++)
+    {
+        char c = reverse ? src[len - 1 - i] : src[i];
+        
+        dst[i] = complement ? complement_map[(uint8) c] : c;
+    }
+}
+
+/*
+ * Transform the bases of a plain sequence
+ */
+static void
+transform_plain(const char *src, char *dst, uint32 len,
+                bool reverse, bool complement)
+{
+    uint32 i = 0;
+    
+#if defined(__SSE2__)
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v;
+        
+        v = _mm_loadu_si128((const __m128i *) (src + (reverse ? len - i - 16 : i)));
+        if (reverse)
+            v = reverse16(v);
+        if (complement && !complement16(v, &v))
+        {
+            transform_scalar(src, dst, len, i, i + 16, reverse, complement);
+            continue;
+        }
+        _mm_storeu_si128((__m128i *) (dst + i), v);
+    }
+#endif
+    
+    transform_scalar(src, dst, len, i, len, reverse, complement);
+}
+
+/*
+ * Reverse the order of the four 2-bit codes in each byte of a word
+ */
+static inline uint64
+reverse_codes(uint64 x)
+{
+    x = ((x >> 2) & UINT64CONST(0x3333333333333333)) |
+        ((x & UINT64CONST(0x3333333333333333)) << 2);
+    x = ((x >> 4) & UINT64CONST(0x0F0F0F0F0F0F0F0F)) |
+        ((x & UINT64CONST(0x0F0F0F0F0F0F0F0F)) << 4);
+    return x;
+}
+
+/*
+ * Transform the packed bits of a sequence
+ *
+ * Slots covered by runs and the padding of the last byte are zero in the
+ * input; the caller clears the run slots of the output, and padding is
+ * cleared here.
+ */
+static void
+transform_packed(const uint8 *src, uint8 *dst, uint32 len,
+                 bool reverse, bool complement)
+{
+    Size nbytes = DNA_PACKED_NBYTES(len);
+    uint8 flip = complement ? 0xFF : 0x00;
+    int pad = (int) (nbytes * 4 - len);
+    Size i = 0;
+    
+    if (!reverse)
+    {
+        for (; i + sizeof(uint64) <= nbytes; i += sizeof(uint64))
+        {
+            uint64 w;
+            
+            memcpy(&w, src + i, sizeof(uint64));
+            if (complement)
+                w = ~w;
+            memcpy(dst + i, &w, sizeof(uint64));
+        }
+        for (; i < nbytes; i++)
+            dst[i] = src[i] ^ flip;
+    }
+    else
+    {
+        /* Byte swap plus code swap reverses a word 32 bases at a time */
+        for (; i + sizeof(uint64) <= nbytes; i += sizeof(uint64))
+        {
+            uint64 w;
+            
+            memcpy(&w, src + nbytes - i - sizeof(uint64), sizeof(uint64));
+            w = reverse_codes(pg_bswap64(w));
+            if (complement)
+                w = ~w;
+            memcpy(dst + i, &w, sizeof(uint64));
+        }
+        for (; i < nbytes; i++)
+            dst[i] = (uint8) reverse_codes(src[nbytes - 1 - i]) ^ flip;
+        
+        /*
+         * The padding of the input now leads the output; shift it out to
+         * the end
+         */
+        if (pad > 0)
+        {
+            int shift = 2 * pad;
+            
+            for (i = 0; i + 1 < nbytes; i++)
+                dst[i] = (uint8) ((dst[i] << shift) | (dst[i + 1] >> (8 - shift)));
+            dst[nbytes - 1] = (uint8) (dst[nbytes - 1] << shift);
+        }
+    }
+    
+    /* Complemented padding of a forward transform reads as T; clear it */
+    if (!reverse && complement && pad > 0)
+        dst[nbytes - 1] &= (uint8) (0xFF << (2 * pad));
+}
+
+/*
+ * Compute the palindrome and canonical summary flags of a value
+ *
+ * Compares the sequence with its reverse complement a chunk from each end
+ * at a time; unless the value is (nearly) a palindrome this stops at the
+ * first chunk.
+ */
+static uint32
+strand_flags(const dna *d)
+{
+    char front[DNA_STRAND_CHUNK];
+    char back[DNA_STRAND_CHUNK];
+    uint32 len = d->length;
+    uint32 half = (len + 1) / 2;
+    uint32 pos = 0;
+    
+    while (pos < half)
+    {
+        uint32 count = Min(half - pos, DNA_STRAND_CHUNK);
+        uint32 j;
+        
+        dna_unpack(d, pos, count, front);
+        dna_unpack(d, len - pos - count, count, back);
+        
+        for (j = 0; j < count; j++)
+        {
+            char rc = complement_map[(uint8) back[count - 1 - j]];
+            
+            if (front[j] != rc)
+            {
+                uint32 flags = 0;
+                
+                if (pos + j >= len / 2)
+                    flags |= DNA_SUMMARY_PALINDROME;
+                if (front[j] < rc)
+                    flags |= DNA_SUMMARY_CANONICAL;
+                return flags;
+            }
+        }
+        
+        pos += count;
+    }
+    
+    return DNA_SUMMARY_PALINDROME | DNA_SUMMARY_CANONICAL;
+}
+
+/*
+ * Build the complement, reverse or reverse complement of a DNA value
+ */
+dna *
+dna_transform(const dna *d, bool reverse, bool complement)
+{
+    uint32 len = d->length;
+    dna *result = (dna *) palloc(VARSIZE(d));
+    char *body;
+    
+    memcpy(result, d, DNA_HDRSZ);
+    body = (char *) DNA_BODY(result);
+    
+    if (!DNA_IS_PACKED(d))
+    {
+        transform_plain(DNA_BODY(d), body, len, reverse, complement);
+    }
+    else
+    {
+        uint32 nruns = DNA_NRUNS(d);
+        const DnaRun *runs = DNA_RUNS(d);
+        DnaRun *out_runs = (DnaRun *) (body + sizeof(uint32));
+        uint8 *bits = (uint8 *) (out_runs + nruns);
+        uint32 r;
+        
+        *(uint32 *) body = nruns;
+        transform_packed(DNA_PACKED_BITS(d), bits, len, reverse, complement);
+        
+        for (r = 0; r < nruns; r++)
+        {
+            const DnaRun *in = &runs[reverse ? nruns - 1 - r : r];
+            DnaRun *out = &out_runs[r];
+            uint32 i;
+            
+            memset(out, 0, sizeof(DnaRun));
+            out->start = reverse ? len - in->start - in->len : in->start;
+            out->len = in->len;
+            out->code = complement ? complement_map[(uint8) in->code] : in->code;
+            
+            /* Run slots stay zero so the representation remains canonical */
+            if (complement)
+            {
+                for (i = out->start; i < out->start + out->len; i++)
+                    bits[i >> 2] &= (uint8) ~(3 << PACK_SHIFT(i));
+            }
+        }
+    }
+    
+    if (DNA_HAS_SUMMARY(d))
+    {
+        const DnaSummary *in = DNA_SUMMARY(d);
+        DnaSummary *out = (DnaSummary *) result->data;
+        int i;
+        
+        for (i = 0; i < DNA_NSYMBOLS; i++)
+        {
+            int index = complement ?
+                dna_symbol_index(complement_map[(uint8) DNA_SYMBOLS[i]]) : i;
+            
+            out->counts[index] = in->counts[i];
+        }
+        out->flags = (in->flags & DNA_SUMMARY_ONLY_ACGT) | strand_flags(result);
+    }
+    
+    return result;
+}
@@ -0,0 +1,335 @@
+#include "dna.h"
+#include <string.h>
+#include "port/pg_bitutils.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Substring search on raw bases
+ *
+ * Needles shorter than DNA_SEARCH_LONG are found with a vectorized filter:
+ * each block of candidate positions is compared against the first and the
+ * last base of the needle at once, and only positions matching both are
+ * verified.  Longer needles use Horspool with shifts keyed on the last two
+ * bases of the window; over a four-letter alphabet a single base almost
+ * always occurs near the end of the needle, so bigrams skip much further.
+ *
+ * A packed haystack is decoded DNA_SEARCH_CHUNK bases at a time, with
+ * chunks overlapping by the needle length so that no occurrence is missed.
+ */
+
+/*
+ * Bigram key of two uppercase symbols
+ * Only the low 5 bits of each symbol are used, so the gap shares its key
+ * with M; the shift table keeps the smallest shift of colliding bigrams.
+ */
+#define DNA_SEARCH_BIGRAM(a, b) ((((uint8) (a) & 0x1F) << 5) | ((uint8) (b) & 0x1F))
+
+/*
+ * Preprocess a needle
+ * The needle bases are referenced, not copied, and must outlive the search.
+ */
+void
+dna_search_init(DnaSearch *search, const char *needle, uint32 len)
+{
+    uint32 i;
+    
+    search->needle = needle;
+    search->len = len;
+    
+    if (len < DNA_SEARCH_LONG)
+        return;
+    
+    /* Without a match, the first base of the needle can still line up */
+    for (i = 0; i < lengthof(search->shift); i++)
+        search->shift[i] = len - 1;
+    for (i = 1; i + 1 < len; i++)
+        search->shift[DNA_SEARCH_BIGRAM(needle[i - 1], needle[i])] = len - 1 - i;
+}
+
+/*
+ * Verify candidate starts flagged in mask, relative to pos
+ * Returns the first full match, or -1
+ */
+static inline int
+search_verify(const char *text, uint32 pos, uint32 mask,
+              const char *needle, uint32 len)
+{
+    while (mask != 0)
+    {
+        uint32 start = pos + pg_rightmost_one_pos32(mask);
+        
+        if (memcmp(text + start + 1, needle + 1, len - 2) == 0)
+            return start;
+        mask &= mask - 1;
+    }
+    
+    return -1;
+}
+
+/*
+ * First-and-last-base filter for needles of 2 to DNA_SEARCH_LONG - 1 bases
+ */
+static int
+search_short(const char *text, uint32 text_len, uint32 from,
+             const char *needle, uint32 len)
+{
+    uint32 pos = from;
+    uint32 last = text_len - len;
+    
+#if defined(__AVX2__)
+    const __m256i first_base = _mm256_set1_epi8(needle[0]);
+    const __m256i last_base = _mm256_set1_epi8(needle[len - 1]);
+    
+    for (; pos + 32 <= last + 1; pos += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (text + pos));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (text + pos + len - 1));
+        uint32 mask;
+        int found;
+        
+        mask = (uint32) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first_base),
+                                                              _mm256_cmpeq_epi8(b, last_base)));
+        found = search_verify(text, pos, mask, needle, len);
+        if (found >= 0)
+            return found;
+    }
+#elif defined(__SSE2__)
+    const __m128i first_base = _mm_set1_epi8(needle[0]);
+    const __m128i last_base = _mm_set1_epi8(needle[len - 1]);
+    
+    for (; pos + 16 <= last + 1; pos += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (text + pos));
+        __m128i b = _mm_loadu_si128((const __m128i *) (text + pos + len - 1));
+        uint32 mask;
+        int found;
+        
+        mask = (uint32) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first_base),
+                                                        _mm_cmpeq_epi8(b, last_base)));
+        found = search_verify(text, pos, mask, needle, len);
+        if (found >= 0)
+            return found;
+    }
+#endif
+    
+    for (; pos <= last; pos++)
+    {
+        if (text[pos] == needle[0] && text[pos + len - 1] == needle[len - 1] &&
+            memcmp(text + pos + 1, needle + 1, len - 2) == 0)
+            return pos;
+    }
+    
+    return -1;
+}
+
+/*
+ * Horspool search with bigram shifts for needles of DNA_SEARCH_LONG bases
+ * or more
+ */
+static int
+search_long(const DnaSearch *search, const char *text, uint32 text_len,
+            uint32 from)
+{
+    const char *needle = search->needle;
+    uint32 len = search->len;
+    uint32 pos = from;
+    uint32 last = text_len - len;
+    
+    while (pos <= last)
+    {
+        const char *window = text + pos;
+        
+        if (window[len - 1] == needle[len - 1] &&
+            memcmp(window, needle, len - 1) == 0)
+            return pos;
+        pos += search->shift[DNA_SEARCH_BIGRAM(window[len - 2], window[len - 1])];
+    }
+    
+    return -1;
+}
+
+/*
+ * Position of the first occurrence of the needle in text at or after from,
+ * or -1
+ */
+int
+dna_search_bytes(const DnaSearch *search, const char *text, uint32 text_len,
+                 uint32 from)
+{
+    uint32 len = search->len;
+    const char *p;
+    
+    if ((uint64) from + len > text_len)
+        return -1;
+    
+    if (len == 0)
+        return from;
+    
+    if (len == 1)
+    {
+        p = memchr(text + from, search->needle[0], text_len - from);
+        return p != NULL ? p - text : -1;
+    }
+    
+    if (len < DNA_SEARCH_LONG)
+        return search_short(text, text_len, from, search->needle, len);
+    
+    return search_long(search, text, text_len, from);
+}
+
+/*
+ * Start a scan of a detoasted haystack
+ */
+void
+dna_search_begin(DnaSearchScan *scan, const DnaSearch *search,
+                 const dna *haystack)
+{
+    scan->search = search;
+    scan->haystack = haystack;
+    scan->next = 0;
+    scan->buf = NULL;
+    scan->buf_start = 0;
+    scan->buf_count = 0;
+}
+
+/*
+ * Position of the next occurrence, or -1 when there is none left
+ * Overlapping occurrences are all reported, in increasing order.
+ */
+int32
+dna_search_next(DnaSearchScan *scan)
+{
+    const dna *haystack = scan->haystack;
+    uint32 len = scan->search->len;
+    int found;
+    
+    while ((uint64) scan->next + len <= haystack->length)
+    {
+        uint32 buf_end;
+        
+        if (!DNA_IS_PACKED(haystack))
+        {
+            found = dna_search_bytes(scan->search, DNA_BODY(haystack),
+                                     haystack->length, scan->next);
+            if (found < 0)
+                break;
+            scan->next = found + 1;
+            return found;
+        }
+        
+        /* Decode the chunk of bases reachable from the next start */
+        buf_end = scan->buf_start + scan->buf_count + 1 - len;
+        if (scan->buf == NULL || scan->next >= buf_end)
+        {
+            if (scan->buf == NULL)
+                scan->buf = palloc(DNA_SEARCH_CHUNK + len);
+            scan->buf_start = scan->next;
+            scan->buf_count = Min(haystack->length - scan->next,
+                                  DNA_SEARCH_CHUNK + len - 1);
+            dna_unpack(haystack, scan->buf_start, scan->buf_count, scan->buf);
+            buf_end = scan->buf_start + scan->buf_count + 1 - len;
+        }
+        
+        found = dna_search_bytes(scan->search, scan->buf, scan->buf_count,
+                                 scan->next - scan->buf_start);
+        if (found >= 0)
+        {
+            scan->next = scan->buf_start + found + 1;
+            return scan->buf_start + found;
+        }
+        scan->next = buf_end;
+    }
+    
+    scan->next = haystack->length + 1;
+    return -1;
+}
+
+/*
+ * Release the resources of a scan
+ */
+void
+dna_search_end(DnaSearchScan *scan)
+{
+    if (scan->buf != NULL)
+        pfree(scan->buf);
+    scan->buf = NULL;
+}
+
+/*
+ * Position of the first occurrence of a needle in a detoasted haystack, or -1
+ */
+int32
+dna_search_first(const DnaSearch *search, const dna *haystack)
+{
+    DnaSearchScan scan;
+    int32 result;
+    
+    if (search->len > haystack->length)
+        return -1;
+    
+    dna_search_begin(&scan, search, haystack);
+    result = dna_search_next(&scan);
+    dna_search_end(&scan);
+    
+    return result;
+}
+
+/*
+ * Search state for a needle, kept across calls in fn_extra
+ *
+ * Operators such as "seq @> 'GAATTC'" see the same needle on every row, so
+ * the decoded bases and the skip table are built once, in fn_mcxt.  A copy
+ * of the needle datum is kept to notice when the argument changes, in
+ * which case the state is rebuilt.
+ */
+typedef struct
+{
+    DnaSearch search;
+    char *bases;        /* Decoded needle bases */
+    char *datum;        /* Copy of the needle the state was built from */
+    Size size;          /* Size of that copy */
+} DnaSearchCache;
+
+/*
+ * Get the search state for a detoasted needle, reusing the cached one when
+ * the needle has not changed since the previous call
+ *
+ * The needle of the returned search also gives the decoded bases of the
+ * argument to functions that only need those.
+ */
+const DnaSearch *
+dna_search_cached(FmgrInfo *flinfo, const dna *needle)
+{
+    DnaSearchCache *cache = (DnaSearchCache *) flinfo->fn_extra;
+    Size size = VARSIZE(needle);
+    
+    if (cache != NULL && cache->size == size &&
+        memcmp(cache->datum, needle, size) == 0)
+        return &cache->search;
+    
+    if (cache == NULL)
+    {
+        cache = MemoryContextAllocZero(flinfo->fn_mcxt, sizeof(DnaSearchCache));
+        flinfo->fn_extra = cache;
+    }
+    else
+    {
+        pfree(cache->datum);
+        pfree(cache->bases);
+    }
+    
+    cache->datum = MemoryContextAlloc(flinfo->fn_mcxt, size);
+    memcpy(cache->datum, needle, size);
+    cache->size = size;
+    
+    cache->bases = MemoryContextAlloc(flinfo->fn_mcxt, Max(needle->length, 1));
+    dna_unpack(needle, 0, needle->length, cache->bases);
+    dna_search_init(&cache->search, cache->bases, needle->length);
+    
+    return &cache->search;
+}
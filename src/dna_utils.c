@@ -2,7 +2,7 @@
 #include "iupac.h"
 #include <string.h>
 #include <ctype.h>
-#include "catalog/namespace.h"
+#include "funcapi.h"
 
 /*
  * DNA utility functions
@@ -10,13 +10,14 @@
 
 /*
  * Get the length of a DNA sequence
+ * Only the length field, first in the payload, is detoasted
  */
 PG_FUNCTION_INFO_V1(dna_length);
 Datum
 dna_length(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
-    int32 len = VARSIZE_ANY_EXHDR(d);
+    dna *d = (dna *) PG_DETOAST_DATUM_SLICE(PG_GETARG_DATUM(0), 0, sizeof(uint32));
+    int32 len = d->length;
     
     PG_RETURN_INT32(len);
 }
@@ -27,22 +28,206 @@ dna_length(PG_FUNCTION_ARGS)
 char *
 dna_get_str(const dna *d)
 {
-    int len = VARSIZE_ANY_EXHDR(d);
+    int len = d->length;
     char *result = palloc(len + 1);
     
-    memcpy(result, d->data, len);
+    dna_unpack(d, 0, len, result);
     result[len] = '\0';
     
     return result;
 }
 
+/*
+ * Get a read-only view of the bases of a DNA datum
+ *
+ * The datum is detoasted without forcing a 4-byte header, so a short
+ * inline value is not copied at all unless it is packed.  Its header
+ * fields may then be unaligned and are read with memcpy.
+ */
+DnaView
+dna_get_view(Datum datum)
+{
+    struct varlena *raw = PG_DETOAST_DATUM_PACKED(datum);
+    const char *payload = VARDATA_ANY(raw);
+    uint32 header[2];
+    DnaView view;
+    
+    memcpy(header, payload, sizeof(header));
+    view.length = header[0];
+    
+    if (!(header[1] & DNA_FLAG_PACKED))
+    {
+        view.bases = payload + sizeof(header) + DNA_BODY_OFFSET(header[1]);
+        view.buffer = NULL;
+    }
+    else
+    {
+        /* Packed payloads need an aligned run list to decode */
+        dna *d = (dna *) PG_DETOAST_DATUM(PointerGetDatum(raw));
+        
+        view.buffer = palloc(Max(view.length, 1));
+        dna_unpack(d, 0, view.length, view.buffer);
+        view.bases = view.buffer;
+        
+        if ((Pointer) d != (Pointer) raw)
+            pfree(d);
+    }
+    
+    return view;
+}
+
+/*
+ * Release the decoded bases of a view, if any
+ */
+void
+dna_release_view(DnaView *view)
+{
+    if (view->buffer)
+        pfree(view->buffer);
+    view->buffer = NULL;
+    view->bases = NULL;
+}
+
 /*
  * Get the actual length of DNA sequence
  */
 int
 dna_get_length(const dna *d)
 {
-    return VARSIZE_ANY_EXHDR(d);
+    return d->length;
+}
+
+/* Offset of a field within the detoasted payload, which excludes vl_len_ */
+#define DNA_SLICE_OFFSET(off)   ((int32) (DNA_HDRSZ - VARHDRSZ + (off)))
+
+/*
+ * Fetch bases [start, start + count) of a possibly toasted DNA datum
+ *
+ * Only the slices covering the header, the run list and the requested
+ * bases are detoasted, so reading a short range of an uncompressed
+ * out-of-line value touches just the TOAST chunks it spans.  The range is
+ * clipped to the sequence; the number of bases returned is stored in
+ * *nfetched and the buffer is NUL-terminated.
+ */
+char *
+dna_fetch_range(Datum datum, int32 start, int32 count, int32 *nfetched)
+{
+    dna *head;
+    uint32 length;
+    uint32 nruns = 0;
+    Size body;
+    bool packed;
+    char *result;
+    
+    if (start < 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_SUBSTRING_ERROR),
+                 errmsg("negative start position not allowed")));
+    if (count < 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_SUBSTRING_ERROR),
+                 errmsg("negative substring length not allowed")));
+    
+    /* Header fields, plus the run count in case the value is packed */
+    head = (dna *) PG_DETOAST_DATUM_SLICE(datum, 0,
+                                          DNA_SLICE_OFFSET(sizeof(DnaSummary) + sizeof(uint32)));
+    length = head->length;
+    body = DNA_BODY_OFFSET(head->flags);
+    packed = DNA_IS_PACKED(head);
+    if (packed)
+        nruns = DNA_NRUNS(head);
+    pfree(head);
+    
+    if ((uint32) start >= length)
+        count = 0;
+    else
+        count = Min((uint32) count, length - start);
+    
+    result = palloc(count + 1);
+    
+    if (count > 0 && !packed)
+    {
+        struct varlena *slice;
+        
+        slice = PG_DETOAST_DATUM_SLICE(datum, DNA_SLICE_OFFSET(body + start), count);
+        memcpy(result, VARDATA(slice), count);
+        pfree(slice);
+    }
+    else if (count > 0)
+    {
+        uint32 first = start / 4;
+        uint32 last = (start + count + 3) / 4;
+        Size bits_offset = body + sizeof(uint32) + nruns * sizeof(DnaRun);
+        struct varlena *runs = NULL;
+        struct varlena *bits;
+        
+        if (nruns > 0)
+            runs = PG_DETOAST_DATUM_SLICE(datum, DNA_SLICE_OFFSET(body + sizeof(uint32)),
+                                          nruns * sizeof(DnaRun));
+        bits = PG_DETOAST_DATUM_SLICE(datum, DNA_SLICE_OFFSET(bits_offset + first),
+                                      last - first);
+        
+        dna_unpack_packed((const uint8 *) VARDATA(bits), first * 4,
+                          runs ? (const DnaRun *) VARDATA(runs) : NULL, nruns,
+                          start, count, result);
+        
+        if (runs)
+            pfree(runs);
+        pfree(bits);
+    }
+    
+    result[count] = '\0';
+    *nfetched = count;
+    
+    return result;
+}
+
+/*
+ * Fetch the summary of a possibly toasted DNA datum
+ *
+ * Only the prefix holding the header and the summary is detoasted.
+ * Returns false if the value is too short to carry a summary; *length is
+ * set either way.
+ */
+bool
+dna_fetch_summary(Datum datum, DnaSummary *summary, uint32 *length)
+{
+    dna *head;
+    bool found;
+    
+    head = (dna *) PG_DETOAST_DATUM_SLICE(datum, 0, DNA_SLICE_OFFSET(sizeof(DnaSummary)));
+    *length = head->length;
+    found = DNA_HAS_SUMMARY(head);
+    if (found)
+        memcpy(summary, DNA_SUMMARY(head), sizeof(DnaSummary));
+    pfree(head);
+    
+    return found;
+}
+
+/*
+ * Count each of DNA_SYMBOLS in a DNA datum and return its length
+ *
+ * Long values answer from their summary, which needs only a prefix of the
+ * datum; others are detoasted and counted in one pass.
+ */
+uint32
+dna_get_counts(Datum datum, uint32 *counts)
+{
+    DnaSummary summary;
+    uint32 length;
+    dna *d;
+    
+    if (dna_fetch_summary(datum, &summary, &length))
+    {
+        memcpy(counts, summary.counts, sizeof(summary.counts));
+        return length;
+    }
+    
+    d = DatumGetDnaP(datum);
+    dna_count_symbols(d, counts);
+    
+    return d->length;
 }
 
 /*
@@ -71,22 +256,8 @@ Datum
 dna_complement(PG_FUNCTION_ARGS)
 {
     dna *d = PG_GETARG_DNA_P(0);
-    int len = dna_get_length(d);
-    dna *result;
-    char *seq = dna_get_str(d);
-    int i;
-    
-    result = (dna *) palloc(VARHDRSZ + len);
-    SET_VARSIZE(result, VARHDRSZ + len);
     
-    for (i = 0; i < len; i++)
-    {
-        result->data[i] = complement_nucleotide(seq[i]);
-    }
-    
-    pfree(seq);
-    
-    PG_RETURN_DNA_P(result);
+    PG_RETURN_DNA_P(dna_transform(d, false, true));
 }
 
 /*
@@ -97,22 +268,8 @@ Datum
 dna_reverse(PG_FUNCTION_ARGS)
 {
     dna *d = PG_GETARG_DNA_P(0);
-    int len = dna_get_length(d);
-    dna *result;
-    char *seq = dna_get_str(d);
-    int i;
-    
-    result = (dna *) palloc(VARHDRSZ + len);
-    SET_VARSIZE(result, VARHDRSZ + len);
-    
-    for (i = 0; i < len; i++)
-    {
-        result->data[i] = seq[len - 1 - i];
-    }
     
-    pfree(seq);
-    
-    PG_RETURN_DNA_P(result);
+    PG_RETURN_DNA_P(dna_transform(d, true, false));
 }
 
 /*
@@ -123,71 +280,219 @@ Datum
 dna_reverse_complement(PG_FUNCTION_ARGS)
 {
     dna *d = PG_GETARG_DNA_P(0);
-    int len = dna_get_length(d);
-    dna *result;
-    char *seq = dna_get_str(d);
-    int i;
-    
-    result = (dna *) palloc(VARHDRSZ + len);
-    SET_VARSIZE(result, VARHDRSZ + len);
     
-    for (i = 0; i < len; i++)
-    {
-        result->data[i] = complement_nucleotide(seq[len - 1 - i]);
-    }
-    
-    pfree(seq);
-    
-    PG_RETURN_DNA_P(result);
+    PG_RETURN_DNA_P(dna_transform(d, true, true));
 }
 
 /*
  * Generate k-mers from a DNA sequence
+ * With the optional third argument set, each k-mer is replaced by its
+ * canonical form (see kmer_canonical)
  */
 PG_FUNCTION_INFO_V1(generate_kmers);
 Datum
 generate_kmers(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
+    DnaView view = dna_get_view(PG_GETARG_DATUM(0));
     int32 k = PG_GETARG_INT32(1);
-    int seq_len = dna_get_length(d);
-    char *seq = dna_get_str(d);
+    bool canonical = PG_NARGS() > 2 ? PG_GETARG_BOOL(2) : false;
+    int seq_len = view.length;
+    const char *seq = view.bases;
     ArrayType *result;
     Datum *elems;
     int num_kmers;
     int i;
     Oid kmer_type_oid;
+    kmer mask;
+    kmer word = 0;
+    kmer rc_word = 0;
     
     if (k <= 0 || k > seq_len)
         ereport(ERROR,
                 (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                  errmsg("k must be between 1 and sequence length")));
     
-    /* Get the OID of the kmer type */
-    kmer_type_oid = TypenameGetTypid("kmer");
+    if (k > KMER_MAX_K)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("k must be at most %d", KMER_MAX_K)));
+    
+    /*
+     * The element type of the declared kmer[] result, looked up once per
+     * call site: fn_expr is not set for every caller, so go by fn_oid
+     */
+    if (fcinfo->flinfo->fn_extra == NULL)
+    {
+        Oid elemtype = get_element_type(get_func_rettype(fcinfo->flinfo->fn_oid));
+        
+        if (!OidIsValid(elemtype))
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATATYPE_MISMATCH),
+                     errmsg("generate_kmers must be declared to return kmer[]")));
+        
+        fcinfo->flinfo->fn_extra = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt,
+                                                      sizeof(Oid));
+        *(Oid *) fcinfo->flinfo->fn_extra = elemtype;
+    }
+    kmer_type_oid = *(Oid *) fcinfo->flinfo->fn_extra;
     
     num_kmers = seq_len - k + 1;
     elems = (Datum *) palloc(num_kmers * sizeof(Datum));
-    
-    for (i = 0; i < num_kmers; i++)
+    mask = KMER_SENTINEL(k) - 1;
+    
+    /*
+     * Roll the packed word along the sequence, one base per step, and its
+     * reverse complement alongside: the complement of each new base enters
+     * at the high end as the word shifts toward the low end.
+     */
+    for (i = 0; i < seq_len; i++)
     {
-        kmer *km = (kmer *) palloc(VARHDRSZ + sizeof(int32) + k);
-        SET_VARSIZE(km, VARHDRSZ + sizeof(int32) + k);
-        km->k = k;
-        memcpy(km->data, seq + i, k);
+        int code = nucleotide_to_int(seq[i]);
+        
+        if (code < 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("k-mers cannot contain ambiguity code %c at position %d",
+                            seq[i], i)));
         
-        elems[i] = PointerGetDatum(km);
+        word = ((word << 2) | code) & mask;
+        rc_word = (rc_word >> 2) | ((kmer) (3 - code) << (2 * (k - 1)));
+        if (i >= k - 1)
+            elems[i - k + 1] = KmerGetDatum((canonical ? Min(word, rc_word) : word) |
+                                            KMER_SENTINEL(k));
     }
     
     result = construct_array(elems, num_kmers, kmer_type_oid,
-                           -1, false, 'i');
+                           sizeof(kmer), true, 'd');
     
-    pfree(seq);
+    dna_release_view(&view);
     pfree(elems);
     
     PG_RETURN_ARRAYTYPE_P(result);
 }
 
+/*
+ * Scan of the k-mers of a sequence, one window at a time
+ */
+typedef struct
+{
+    DnaCursor cur;
+    uint32 length;      /* Sequence length */
+    int32 k;
+    int32 step;         /* Distance between window starts */
+    bool skip_ambiguous; /* Skip windows with ambiguity codes instead of failing */
+    bool canonical;     /* Return canonical k-mers */
+    uint32 pos;         /* Next base to read */
+    uint32 valid;       /* Unambiguous bases ending just before pos */
+    kmer word;          /* Codes of the last k bases */
+    kmer rc_word;       /* Their reverse complement */
+} KmerScan;
+
+/*
+ * Next k-mer of a scan
+ * Returns false when no window is left.
+ */
+static bool
+kmer_scan_next(KmerScan *scan, kmer *result)
+{
+    kmer mask = KMER_SENTINEL(scan->k) - 1;
+    
+    while (scan->pos < scan->length)
+    {
+        char base = dna_cursor_base(&scan->cur, scan->pos);
+        int code = nucleotide_to_int(base);
+        uint32 start;
+        
+        scan->pos++;
+        if (code < 0)
+        {
+            if (!scan->skip_ambiguous)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("k-mers cannot contain ambiguity code %c at position %d",
+                                base, (int) (scan->pos - 1))));
+            scan->valid = 0;
+            continue;
+        }
+        
+        scan->word = ((scan->word << 2) | code) & mask;
+        scan->rc_word = (scan->rc_word >> 2) | ((kmer) (3 - code) << (2 * (scan->k - 1)));
+        scan->valid++;
+        
+        if (scan->pos < (uint32) scan->k)
+            continue;
+        start = scan->pos - scan->k;
+        if (start % scan->step != 0 || scan->valid < (uint32) scan->k)
+            continue;
+        
+        *result = (scan->canonical ? Min(scan->word, scan->rc_word) : scan->word) |
+            KMER_SENTINEL(scan->k);
+        return true;
+    }
+    
+    return false;
+}
+
+/*
+ * Generate k-mers from a DNA sequence as a set
+ *
+ * Unlike generate_kmers, k-mers are produced one per call, so memory does
+ * not grow with the sequence length.  The third argument keeps only the
+ * windows starting at multiples of step, the fourth skips windows with
+ * ambiguity codes, which generate_kmers rejects, and the fifth returns
+ * canonical k-mers.
+ */
+PG_FUNCTION_INFO_V1(generate_kmers_srf);
+Datum
+generate_kmers_srf(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    KmerScan *scan;
+    kmer result;
+    
+    if (SRF_IS_FIRSTCALL())
+    {
+        MemoryContext oldcontext;
+        dna *d;
+        int32 k = PG_GETARG_INT32(1);
+        int32 step = PG_GETARG_INT32(2);
+        
+        if (k <= 0 || k > KMER_MAX_K)
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("k must be between 1 and %d", KMER_MAX_K)));
+        
+        if (step <= 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("step must be positive")));
+        
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+        
+        /* The detoasted value must outlive the first call */
+        d = PG_GETARG_DNA_P(0);
+        scan = palloc0(sizeof(KmerScan));
+        dna_cursor_init(&scan->cur, d);
+        scan->length = d->length;
+        scan->k = k;
+        scan->step = step;
+        scan->skip_ambiguous = PG_GETARG_BOOL(3);
+        scan->canonical = PG_GETARG_BOOL(4);
+        funcctx->user_fctx = scan;
+        
+        MemoryContextSwitchTo(oldcontext);
+    }
+    
+    funcctx = SRF_PERCALL_SETUP();
+    scan = (KmerScan *) funcctx->user_fctx;
+    
+    if (!kmer_scan_next(scan, &result))
+        SRF_RETURN_DONE(funcctx);
+    
+    SRF_RETURN_NEXT(funcctx, KmerGetDatum(result));
+}
+
 /*
  * IUPAC nucleotide utility functions
  */
@@ -201,17 +506,45 @@ const char complement_map[128] = {
     ['D'] = 'H', ['H'] = 'D', ['N'] = 'N', ['-'] = '-'
 };
 
+/* Normalization table */
+const char nucleotide_normalize_map[256] = {
+    ['A'] = 'A', ['C'] = 'C', ['G'] = 'G', ['T'] = 'T',
+    ['R'] = 'R', ['Y'] = 'Y', ['S'] = 'S', ['W'] = 'W',
+    ['K'] = 'K', ['M'] = 'M', ['B'] = 'B', ['D'] = 'D',
+    ['H'] = 'H', ['V'] = 'V', ['N'] = 'N', ['-'] = '-',
+    ['a'] = 'A', ['c'] = 'C', ['g'] = 'G', ['t'] = 'T',
+    ['r'] = 'R', ['y'] = 'Y', ['s'] = 'S', ['w'] = 'W',
+    ['k'] = 'K', ['m'] = 'M', ['b'] = 'B', ['d'] = 'D',
+    ['h'] = 'H', ['v'] = 'V', ['n'] = 'N'
+};
+
+/* Base sets of the IUPAC codes */
+const uint8 iupac_base_mask[256] = {
+    ['A'] = IUPAC_MASK_A,
+    ['C'] = IUPAC_MASK_C,
+    ['G'] = IUPAC_MASK_G,
+    ['T'] = IUPAC_MASK_T,
+    ['R'] = IUPAC_MASK_A | IUPAC_MASK_G,
+    ['Y'] = IUPAC_MASK_C | IUPAC_MASK_T,
+    ['S'] = IUPAC_MASK_G | IUPAC_MASK_C,
+    ['W'] = IUPAC_MASK_A | IUPAC_MASK_T,
+    ['K'] = IUPAC_MASK_G | IUPAC_MASK_T,
+    ['M'] = IUPAC_MASK_A | IUPAC_MASK_C,
+    ['B'] = IUPAC_MASK_C | IUPAC_MASK_G | IUPAC_MASK_T,
+    ['D'] = IUPAC_MASK_A | IUPAC_MASK_G | IUPAC_MASK_T,
+    ['H'] = IUPAC_MASK_A | IUPAC_MASK_C | IUPAC_MASK_T,
+    ['V'] = IUPAC_MASK_A | IUPAC_MASK_C | IUPAC_MASK_G,
+    ['N'] = IUPAC_MASK_A | IUPAC_MASK_C | IUPAC_MASK_G | IUPAC_MASK_T,
+    ['-'] = IUPAC_MASK_GAP
+};
+
 /*
  * Check if character is a valid nucleotide
  */
 bool
 is_valid_nucleotide(char c)
 {
-    c = toupper(c);
-    return (c == 'A' || c == 'C' || c == 'G' || c == 'T' ||
-            c == 'R' || c == 'Y' || c == 'S' || c == 'W' ||
-            c == 'K' || c == 'M' || c == 'B' || c == 'D' ||
-            c == 'H' || c == 'V' || c == 'N' || c == '-');
+    return nucleotide_normalize_map[(uint8) c] != 0;
 }
 
 /*
@@ -277,23 +610,13 @@ PG_FUNCTION_INFO_V1(dna_count);
 Datum
 dna_count(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
     text *nucl_text = PG_GETARG_TEXT_PP(1);
-    char nucl = *VARDATA_ANY(nucl_text);
-    int len = dna_get_length(d);
-    char *seq = dna_get_str(d);
-    int count = 0;
-    int i;
-    
-    for (i = 0; i < len; i++)
-    {
-        if (toupper(seq[i]) == toupper(nucl))
-            count++;
-    }
+    int index = dna_symbol_index(toupper(*VARDATA_ANY(nucl_text)));
+    uint32 counts[DNA_NSYMBOLS];
     
-    pfree(seq);
+    dna_get_counts(PG_GETARG_DATUM(0), counts);
     
-    PG_RETURN_INT32(count);
+    PG_RETURN_INT32(index >= 0 ? counts[index] : 0);
 }
 
 /*
@@ -303,22 +626,11 @@ PG_FUNCTION_INFO_V1(dna_count_approx);
 Datum
 dna_count_approx(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
-    int len = dna_get_length(d);
-    char *seq = dna_get_str(d);
-    int count = 0;
-    int i;
+    uint32 counts[DNA_NSYMBOLS];
     
-    for (i = 0; i < len; i++)
-    {
-        char c = toupper(seq[i]);
-        if (c == 'G' || c == 'C')
-            count++;
-    }
+    dna_get_counts(PG_GETARG_DATUM(0), counts);
     
-    pfree(seq);
-    
-    PG_RETURN_INT32(count);
+    PG_RETURN_INT32(counts[DNA_SYMBOL_G] + counts[DNA_SYMBOL_C]);
 }
 
 /*
@@ -328,16 +640,33 @@ PG_FUNCTION_INFO_V1(dna_gc_content);
 Datum
 dna_gc_content(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
-    int len = dna_get_length(d);
-    char *seq = dna_get_str(d);
+    uint32 counts[DNA_NSYMBOLS];
+    uint32 len = dna_get_counts(PG_GETARG_DATUM(0), counts);
+    
+    if (len == 0)
+        PG_RETURN_FLOAT8(0.0);
+    
+    PG_RETURN_FLOAT8((double) (counts[DNA_SYMBOL_G] + counts[DNA_SYMBOL_C]) / len);
+}
+
+/*
+ * Calculate GC content of a range of a sequence
+ * Positions are 0-based like dna_find_subsequence; the range is clipped to
+ * the sequence and only the covering TOAST slices are fetched
+ */
+PG_FUNCTION_INFO_V1(dna_gc_content_range);
+Datum
+dna_gc_content_range(PG_FUNCTION_ARGS)
+{
+    int32 len;
+    char *seq = dna_fetch_range(PG_GETARG_DATUM(0), PG_GETARG_INT32(1),
+                                PG_GETARG_INT32(2), &len);
     int gc_count = 0;
     int i;
     
     for (i = 0; i < len; i++)
     {
-        char c = toupper(seq[i]);
-        if (c == 'G' || c == 'C')
+        if (seq[i] == 'G' || seq[i] == 'C')
             gc_count++;
     }
     
@@ -349,6 +678,25 @@ dna_gc_content(PG_FUNCTION_ARGS)
     PG_RETURN_FLOAT8((double)gc_count / len);
 }
 
+/*
+ * Extract a subsequence
+ * Positions are 0-based like dna_find_subsequence; the range is clipped to
+ * the sequence and only the covering TOAST slices are fetched
+ */
+PG_FUNCTION_INFO_V1(dna_substring);
+Datum
+dna_substring(PG_FUNCTION_ARGS)
+{
+    int32 len;
+    char *seq = dna_fetch_range(PG_GETARG_DATUM(0), PG_GETARG_INT32(1),
+                                PG_GETARG_INT32(2), &len);
+    dna *result = dna_make(seq, len);
+    
+    pfree(seq);
+    
+    PG_RETURN_DNA_P(result);
+}
+
 /*
  * Convert DNA sequence to string (for output)
  */
@@ -356,10 +704,12 @@ PG_FUNCTION_INFO_V1(dna_to_string);
 Datum
 dna_to_string(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
-    char *str = dna_get_str(d);
+    DnaView view = dna_get_view(PG_GETARG_DATUM(0));
+    text *result = cstring_to_text_with_len(view.bases, view.length);
+    
+    dna_release_view(&view);
     
-    PG_RETURN_CSTRING(str);
+    PG_RETURN_TEXT_P(result);
 }
 
 /*
@@ -369,19 +719,21 @@ PG_FUNCTION_INFO_V1(string_to_dna);
 Datum
 string_to_dna(PG_FUNCTION_ARGS)
 {
-    text *t = PG_GETARG_TEXT_P(0);
-    char *str = VARDATA(t);
+    text *t = PG_GETARG_TEXT_PP(0);
+    char *str = VARDATA_ANY(t);
     int len = VARSIZE_ANY_EXHDR(t);
+    char *bases = palloc(Max(len, 1));
     dna *result;
-    int i;
+    int bad;
     
-    result = (dna *) palloc(VARHDRSZ + len);
-    SET_VARSIZE(result, VARHDRSZ + len);
+    bad = dna_normalize(str, bases, len);
+    if (bad >= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("invalid nucleotide character: %c", str[bad])));
     
-    for (i = 0; i < len; i++)
-    {
-        result->data[i] = toupper(str[i]);
-    }
+    result = dna_make(bases, len);
+    pfree(bases);
     
     PG_RETURN_DNA_P(result);
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "dna.h"
+#include "funcapi.h"
 
 /*
  * Additional DNA/K-mer utility functions
@@ -12,18 +13,32 @@ PG_FUNCTION_INFO_V1(dna_count_nucleotide);
 Datum
 dna_count_nucleotide(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
-    char target = PG_GETARG_CHAR(1);
-    int len = dna_get_length(d);
-    char *seq = dna_get_str(d);
+    int index = dna_symbol_index(toupper(PG_GETARG_CHAR(1)));
+    uint32 counts[DNA_NSYMBOLS];
+    
+    dna_get_counts(PG_GETARG_DATUM(0), counts);
+    
+    PG_RETURN_INT32(index >= 0 ? counts[index] : 0);
+}
+
+/*
+ * Count occurrences of a specific nucleotide in a range of a sequence
+ * Positions are 0-based; only the covering TOAST slices are fetched
+ */
+PG_FUNCTION_INFO_V1(dna_count_nucleotide_range);
+Datum
+dna_count_nucleotide_range(PG_FUNCTION_ARGS)
+{
+    char target = toupper(PG_GETARG_CHAR(1));
+    int32 len;
+    char *seq = dna_fetch_range(PG_GETARG_DATUM(0), PG_GETARG_INT32(2),
+                                PG_GETARG_INT32(3), &len);
     int count = 0;
     int i;
     
-    target = toupper(target);
-    
     for (i = 0; i < len; i++)
     {
-        if (toupper(seq[i]) == target)
+        if (seq[i] == target)
             count++;
     }
     
@@ -32,6 +47,37 @@ dna_count_nucleotide(PG_FUNCTION_ARGS)
     PG_RETURN_INT32(count);
 }
 
+/*
+ * Full composition of a sequence
+ * Returns the count of each IUPAC symbol and the GC fraction as a record,
+ * from the summary or a single counting pass
+ */
+PG_FUNCTION_INFO_V1(dna_composition);
+Datum
+dna_composition(PG_FUNCTION_ARGS)
+{
+    uint32 counts[DNA_NSYMBOLS];
+    uint32 len = dna_get_counts(PG_GETARG_DATUM(0), counts);
+    Datum values[DNA_NSYMBOLS + 1];
+    bool nulls[DNA_NSYMBOLS + 1];
+    TupleDesc tupdesc;
+    int i;
+    
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("function returning record called in context that cannot accept type record")));
+    tupdesc = BlessTupleDesc(tupdesc);
+    
+    for (i = 0; i < DNA_NSYMBOLS; i++)
+        values[i] = Int32GetDatum(counts[i]);
+    values[DNA_NSYMBOLS] = Float8GetDatum(len == 0 ? 0.0 :
+        (double) (counts[DNA_SYMBOL_G] + counts[DNA_SYMBOL_C]) / len);
+    memset(nulls, 0, sizeof(nulls));
+    
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
 /*
  * Find the first occurrence of a subsequence
  */
@@ -41,19 +87,52 @@ dna_find_subsequence(PG_FUNCTION_ARGS)
 {
     dna *haystack = PG_GETARG_DNA_P(0);
     dna *needle = PG_GETARG_DNA_P(1);
-    char *haystack_str = dna_get_str(haystack);
-    char *needle_str = dna_get_str(needle);
-    char *found;
-    int position = -1;
+    const DnaSearch *search = dna_search_cached(fcinfo->flinfo, needle);
     
-    found = strstr(haystack_str, needle_str);
-    if (found)
-        position = found - haystack_str;
+    PG_RETURN_INT32(dna_search_first(search, haystack));
+}
+
+/*
+ * Find every occurrence of a subsequence
+ * Returns the 0-based start positions in order, overlapping ones included
+ */
+PG_FUNCTION_INFO_V1(dna_find_all);
+Datum
+dna_find_all(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    DnaSearchScan *scan;
+    int32 pos;
+    
+    if (SRF_IS_FIRSTCALL())
+    {
+        MemoryContext oldcontext;
+        DnaView needle_view;
+        DnaSearch *search;
+        
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+        
+        /* The needle view and the haystack live as long as the scan */
+        needle_view = dna_get_view(PG_GETARG_DATUM(1));
+        search = palloc(sizeof(DnaSearch));
+        dna_search_init(search, needle_view.bases, needle_view.length);
+        
+        scan = palloc(sizeof(DnaSearchScan));
+        dna_search_begin(scan, search, PG_GETARG_DNA_P(0));
+        funcctx->user_fctx = scan;
+        
+        MemoryContextSwitchTo(oldcontext);
+    }
     
-    pfree(haystack_str);
-    pfree(needle_str);
+    funcctx = SRF_PERCALL_SETUP();
+    scan = (DnaSearchScan *) funcctx->user_fctx;
     
-    PG_RETURN_INT32(position);
+    pos = dna_search_next(scan);
+    if (pos < 0)
+        SRF_RETURN_DONE(funcctx);
+    
+    SRF_RETURN_NEXT(funcctx, Int32GetDatum(pos));
 }
 
 /*
@@ -63,12 +142,21 @@ PG_FUNCTION_INFO_V1(dna_is_palindrome);
 Datum
 dna_is_palindrome(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
-    int len = dna_get_length(d);
-    char *seq = dna_get_str(d);
+    DnaSummary summary;
+    uint32 length;
+    DnaView view;
+    int len;
+    const char *seq;
     bool is_palindrome = true;
     int i;
     
+    if (dna_fetch_summary(PG_GETARG_DATUM(0), &summary, &length))
+        PG_RETURN_BOOL((summary.flags & DNA_SUMMARY_PALINDROME) != 0);
+    
+    view = dna_get_view(PG_GETARG_DATUM(0));
+    len = view.length;
+    seq = view.bases;
+    
     for (i = 0; i < len / 2; i++)
     {
         if (complement_nucleotide(seq[i]) != seq[len - 1 - i])
@@ -78,37 +166,110 @@ dna_is_palindrome(PG_FUNCTION_ARGS)
         }
     }
     
-    pfree(seq);
+    dna_release_view(&view);
     
     PG_RETURN_BOOL(is_palindrome);
 }
 
+/*
+ * NCBI genetic codes
+ *
+ * Amino acids of the 64 codons in NCBI order: the first base varies
+ * slowest, each base going T, C, A, G.  Tables whose stop codons depend on
+ * context (27, 28, 31) are not included.
+ */
+typedef struct
+{
+    int32 id;           /* NCBI translation table number */
+    const char *amino;  /* Amino acid or '*' of each codon */
+} GeneticCode;
+
+static const GeneticCode genetic_codes[] = {
+    {1, "FFLLSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {2, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNKKSS**VVVVAAAADDEEGGGG"},
+    {3, "FFLLSSSSYY**CCWWTTTTPPPPHHQQRRRRIIMMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {4, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {5, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNKKSSSSVVVVAAAADDEEGGGG"},
+    {6, "FFLLSSSSYYQQCC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {9, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNNKSSSSVVVVAAAADDEEGGGG"},
+    {10, "FFLLSSSSYY**CCCWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {11, "FFLLSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {12, "FFLLSSSSYY**CC*WLLLSPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {13, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNKKSSGGVVVVAAAADDEEGGGG"},
+    {14, "FFLLSSSSYYY*CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNNKSSSSVVVVAAAADDEEGGGG"},
+    {16, "FFLLSSSSYY*LCC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {21, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNNKSSSSVVVVAAAADDEEGGGG"},
+    {22, "FFLLSS*SYY*LCC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {23, "FF*LSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {24, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSSKVVVVAAAADDEEGGGG"},
+    {25, "FFLLSSSSYY**CCGWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {26, "FFLLSSSSYY**CC*WLLLAPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {29, "FFLLSSSSYYYYCC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {30, "FFLLSSSSYYEECC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {33, "FFLLSSSSYYY*CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSSKVVVVAAAADDEEGGGG"}
+};
+
+#define GENETIC_CODE_STANDARD   1
+
+/*
+ * Position of each base in the NCBI order, plus one; 0 for ambiguity codes
+ * and gaps.  Complementing a base is then flipping bit 1 of its position.
+ */
+static const uint8 codon_base[256] = {
+    ['T'] = 1, ['C'] = 2, ['A'] = 3, ['G'] = 4
+};
+
+#define CODON_INVALID           64
+
+static const char *
+genetic_code_get(int32 id)
+{
+    Size i;
+    
+    for (i = 0; i < lengthof(genetic_codes); i++)
+    {
+        if (genetic_codes[i].id == id)
+            return genetic_codes[i].amino;
+    }
+    
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("unsupported genetic code table: %d", id)));
+    return NULL;                /* keep compiler quiet */
+}
+
+/*
+ * Codon index lookup table: the 64 amino acids of a genetic code, and 'X'
+ * at CODON_INVALID for codons with an ambiguity code or a gap
+ */
+static void
+codon_table_init(char *table, int32 id)
+{
+    memcpy(table, genetic_code_get(id), 64);
+    table[CODON_INVALID] = 'X';
+}
+
 /*
  * Translate DNA to amino acid sequence (single frame)
+ * The optional third argument is an NCBI translation table number (default
+ * 1, the standard code).  Codons containing ambiguity codes give X and stop
+ * codons give '*'.
  */
 PG_FUNCTION_INFO_V1(dna_translate);
 Datum
 dna_translate(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
+    DnaView view = dna_get_view(PG_GETARG_DATUM(0));
     int frame = PG_GETARG_INT32(1); /* 0, 1, or 2 */
-    int len = dna_get_length(d);
-    char *seq = dna_get_str(d);
+    int32 code = PG_NARGS() > 2 ? PG_GETARG_INT32(2) : GENETIC_CODE_STANDARD;
+    int len = view.length;
+    const char *seq = view.bases;
+    char table[CODON_INVALID + 1];
     text *result;
     char *aa_seq;
     int aa_len;
     int i, j;
     
-    /* Genetic code table (simplified) */
-    static const char *genetic_code[64] = {
-        "K", "N", "K", "N", "T", "T", "T", "T", /* TTT, TTC, TTA, TTG, TCT, TCC, TCA, TCG */
-        "R", "S", "R", "S", "I", "I", "I", "M", /* TAT, TAC, TAA, TAG, TGT, TGC, TGA, TGG */
-        "Q", "H", "Q", "H", "P", "P", "P", "P", /* CAT, CAC, CAA, CAG, CCT, CCC, CCA, CCG */
-        "R", "R", "R", "R", "L", "L", "L", "L", /* CGT, CGC, CGA, CGG, CTT, CTC, CTA, CTG */
-        "E", "D", "E", "D", "A", "A", "A", "A", /* GAT, GAC, GAA, GAG, GCT, GCC, GCA, GCG */
-        "G", "G", "G", "G", "V", "V", "V", "V"  /* GGT, GGC, GGA, GGG, GTT, GTC, GTA, GTG */
-    };
-    
     if (frame < 0 || frame > 2)
         ereport(ERROR,
                 (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
@@ -119,37 +280,247 @@ dna_translate(PG_FUNCTION_ARGS)
                 (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                  errmsg("sequence too short for translation")));
     
+    codon_table_init(table, code);
+    
     aa_len = (len - frame) / 3;
     aa_seq = palloc(aa_len + 1);
     
     for (i = frame, j = 0; i + 2 < len; i += 3, j++)
     {
-        int codon_index = 0;
-        char c1 = toupper(seq[i]);
-        char c2 = toupper(seq[i + 1]);
-        char c3 = toupper(seq[i + 2]);
-        
-        /* Simple codon to index mapping (incomplete) */
-        if (c1 == 'T' && c2 == 'T' && c3 == 'T')
-            codon_index = 0; /* TTT -> F */
-        else
-            codon_index = 0; /* Default to first amino acid */
+        int b1 = codon_base[(uint8) seq[i]];
+        int b2 = codon_base[(uint8) seq[i + 1]];
+        int b3 = codon_base[(uint8) seq[i + 2]];
         
-        aa_seq[j] = 'X'; /* Placeholder - full implementation would use proper genetic code */
+        if (b1 == 0 || b2 == 0 || b3 == 0)
+            aa_seq[j] = table[CODON_INVALID];
+        else
+            aa_seq[j] = table[((b1 - 1) << 4) | ((b2 - 1) << 2) | (b3 - 1)];
     }
     
     aa_seq[j] = '\0';
     
-    result = cstring_to_text(aa_seq);
+    result = cstring_to_text_with_len(aa_seq, aa_len);
     
-    pfree(seq);
+    dna_release_view(&view);
     pfree(aa_seq);
     
     PG_RETURN_TEXT_P(result);
 }
 
+/* Six-frame translation, frames 1, 2, 3 then -1, -2, -3 */
+typedef struct
+{
+    char *protein[6];
+    int32 length[6];
+    int next;           /* Next frame to return */
+} SixFrames;
+
+/*
+ * Translate the six frames of a sequence in one pass
+ *
+ * The codon starting at each position is read once: on the forward strand
+ * it belongs to frame position % 3, and its reverse complement starts at
+ * len - 3 - position on the other strand.
+ */
+static void
+translate_six_frames(SixFrames *frames, const char *seq, uint32 len,
+                     const char *table)
+{
+    uint32 codon = 0;
+    uint32 valid = 0;
+    uint32 i;
+    int f;
+    
+    for (f = 0; f < 3; f++)
+    {
+        int32 n = len >= (uint32) f + 3 ? (len - f) / 3 : 0;
+        
+        frames->length[f] = n;
+        frames->length[f + 3] = n;
+        frames->protein[f] = palloc(Max(n, 1));
+        frames->protein[f + 3] = palloc(Max(n, 1));
+    }
+    
+    for (i = 0; i < len; i++)
+    {
+        int b = codon_base[(uint8) seq[i]];
+        uint32 rc_start;
+        uint32 rc_codon;
+        
+        /* Keep the last three bases, and how many of them are unambiguous */
+        codon = ((codon << 2) | (b - 1)) & 0x3F;
+        valid = b != 0 ? Min(valid + 1, 3) : 0;
+        if (i < 2)
+            continue;
+        
+        /* Complement each base and swap the first and third */
+        rc_codon = codon ^ 0x2A;
+        rc_codon = ((rc_codon & 0x3) << 4) | (rc_codon & 0xC) | (rc_codon >> 4);
+        rc_start = len - 1 - i;
+        
+        frames->protein[(i - 2) % 3][(i - 2) / 3] = table[valid == 3 ? codon : CODON_INVALID];
+        frames->protein[3 + rc_start % 3][rc_start / 3] = table[valid == 3 ? rc_codon : CODON_INVALID];
+    }
+}
+
+/*
+ * Translate all six reading frames
+ * Returns (frame, protein) rows for frames 1, 2, 3 of the sequence and
+ * -1, -2, -3 of its reverse complement, each starting 0, 1 or 2 bases in.
+ * The second argument is an NCBI translation table number.
+ */
+PG_FUNCTION_INFO_V1(dna_translate_6frame);
+Datum
+dna_translate_6frame(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    SixFrames *frames;
+    Datum values[2];
+    bool nulls[2] = {false, false};
+    int f;
+    
+    if (SRF_IS_FIRSTCALL())
+    {
+        MemoryContext oldcontext;
+        TupleDesc tupdesc;
+        int32 code = PG_GETARG_INT32(1);
+        char table[CODON_INVALID + 1];
+        DnaView view;
+        
+        codon_table_init(table, code);
+        
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+        
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("function returning record called in context that cannot accept type record")));
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+        
+        frames = palloc0(sizeof(SixFrames));
+        view = dna_get_view(PG_GETARG_DATUM(0));
+        translate_six_frames(frames, view.bases, view.length, table);
+        dna_release_view(&view);
+        funcctx->user_fctx = frames;
+        
+        MemoryContextSwitchTo(oldcontext);
+    }
+    
+    funcctx = SRF_PERCALL_SETUP();
+    frames = (SixFrames *) funcctx->user_fctx;
+    
+    if (frames->next == 6)
+        SRF_RETURN_DONE(funcctx);
+    
+    f = frames->next++;
+    values[0] = Int32GetDatum(f < 3 ? f + 1 : 2 - f);
+    values[1] = PointerGetDatum(cstring_to_text_with_len(frames->protein[f],
+                                                         frames->length[f]));
+    
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(funcctx->tuple_desc,
+                                                               values, nulls)));
+}
+
+/*
+ * Running G and C counts over the windows of a sequence
+ *
+ * Each step only looks at the bases leaving and entering the window, so a
+ * full scan is O(n) whatever the window size.  Packed values are decoded a
+ * chunk at a time through the cursors.
+ */
+typedef struct
+{
+    DnaCursor lead;     /* Reads bases entering the window */
+    DnaCursor trail;    /* Reads bases leaving the window */
+    uint32 length;      /* Sequence length */
+    uint32 window;      /* Window size */
+    uint32 step;        /* Distance between window starts */
+    uint32 start;       /* Start of the current window */
+    bool started;       /* Whether the first window has been counted */
+    int32 g;            /* G count of the current window */
+    int32 c;            /* C count of the current window */
+} GcWindows;
+
+static void
+gc_windows_init(GcWindows *st, const dna *d, int32 window, int32 step)
+{
+    if (window <= 0 || (uint32) window > d->length)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("window size must be between 1 and sequence length")));
+    
+    if (step <= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("step must be positive")));
+    
+    dna_cursor_init(&st->lead, d);
+    dna_cursor_init(&st->trail, d);
+    st->length = d->length;
+    st->window = window;
+    st->step = step;
+    st->start = 0;
+    st->started = false;
+    st->g = 0;
+    st->c = 0;
+}
+
+static inline void
+gc_windows_update(GcWindows *st, char base, int delta)
+{
+    if (base == 'G')
+        st->g += delta;
+    else if (base == 'C')
+        st->c += delta;
+}
+
+/*
+ * Move to the next window
+ * Returns false when no window is left
+ */
+static bool
+gc_windows_next(GcWindows *st)
+{
+    uint32 next;
+    uint32 i;
+    
+    if (!st->started)
+    {
+        for (i = 0; i < st->window; i++)
+            gc_windows_update(st, dna_cursor_base(&st->lead, i), 1);
+        st->started = true;
+        return true;
+    }
+    
+    if ((uint64) st->start + st->step + st->window > st->length)
+        return false;
+    next = st->start + st->step;
+    
+    if (st->step < st->window)
+    {
+        for (i = st->start; i < next; i++)
+            gc_windows_update(st, dna_cursor_base(&st->trail, i), -1);
+        for (i = st->start + st->window; i < next + st->window; i++)
+            gc_windows_update(st, dna_cursor_base(&st->lead, i), 1);
+    }
+    else
+    {
+        /* Windows do not overlap: count the new one from scratch */
+        st->g = 0;
+        st->c = 0;
+        for (i = next; i < next + st->window; i++)
+            gc_windows_update(st, dna_cursor_base(&st->lead, i), 1);
+    }
+    
+    st->start = next;
+    return true;
+}
+
 /*
  * Generate sliding window statistics
+ * Returns the GC fraction of each window; the optional third argument is
+ * the distance between window starts (default 1)
  */
 PG_FUNCTION_INFO_V1(dna_sliding_gc);
 Datum
@@ -157,40 +528,87 @@ dna_sliding_gc(PG_FUNCTION_ARGS)
 {
     dna *d = PG_GETARG_DNA_P(0);
     int window_size = PG_GETARG_INT32(1);
-    int len = dna_get_length(d);
-    char *seq = dna_get_str(d);
+    int step = PG_NARGS() > 2 ? PG_GETARG_INT32(2) : 1;
+    GcWindows *st = palloc(sizeof(GcWindows));
     ArrayType *result;
     Datum *elems;
     int num_windows;
     int i;
     
-    if (window_size <= 0 || window_size > len)
-        ereport(ERROR,
-                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                 errmsg("window size must be between 1 and sequence length")));
+    gc_windows_init(st, d, window_size, step);
     
-    num_windows = len - window_size + 1;
+    num_windows = (st->length - st->window) / st->step + 1;
     elems = (Datum *) palloc(num_windows * sizeof(Datum));
     
-    for (i = 0; i < num_windows; i++)
+    for (i = 0; gc_windows_next(st); i++)
     {
-        int gc_count = 0;
-        int j;
-        
-        for (j = i; j < i + window_size; j++)
-        {
-            char c = toupper(seq[j]);
-            if (c == 'G' || c == 'C')
-                gc_count++;
-        }
-        
-        elems[i] = Float8GetDatum((double)gc_count / window_size);
+        elems[i] = Float8GetDatum((double) (st->g + st->c) / window_size);
     }
     
+    Assert(i == num_windows);
+    
     result = construct_array(elems, num_windows, FLOAT8OID, 8, true, 'd');
     
-    pfree(seq);
+    pfree(st);
     pfree(elems);
     
     PG_RETURN_ARRAYTYPE_P(result);
+}
+
+/*
+ * Sliding window GC statistics as a set of rows
+ * Returns (position, gc, gc_skew) one window per call, so memory does not
+ * grow with the number of windows.  GC skew is (G - C) / (G + C), NULL for
+ * windows without any G or C.
+ */
+PG_FUNCTION_INFO_V1(dna_gc_windows);
+Datum
+dna_gc_windows(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    GcWindows *st;
+    Datum values[3];
+    bool nulls[3];
+    HeapTuple tuple;
+    
+    if (SRF_IS_FIRSTCALL())
+    {
+        MemoryContext oldcontext;
+        TupleDesc tupdesc;
+        
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+        
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("function returning record called in context that cannot accept type record")));
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+        
+        /* The detoasted value must outlive the first call */
+        st = palloc(sizeof(GcWindows));
+        gc_windows_init(st, PG_GETARG_DNA_P(0), PG_GETARG_INT32(1),
+                        PG_GETARG_INT32(2));
+        funcctx->user_fctx = st;
+        
+        MemoryContextSwitchTo(oldcontext);
+    }
+    
+    funcctx = SRF_PERCALL_SETUP();
+    st = (GcWindows *) funcctx->user_fctx;
+    
+    if (!gc_windows_next(st))
+        SRF_RETURN_DONE(funcctx);
+    
+    memset(nulls, 0, sizeof(nulls));
+    values[0] = Int32GetDatum(st->start);
+    values[1] = Float8GetDatum((double) (st->g + st->c) / st->window);
+    if (st->g + st->c > 0)
+        values[2] = Float8GetDatum((double) (st->g - st->c) / (st->g + st->c));
+    else
+        nulls[2] = true;
+    
+    tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+    
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
 }
\ No newline at end of file
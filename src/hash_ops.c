@@ -1,4 +1,5 @@
 #include "dna.h"
+#include "funcapi.h"
 
 /*
  * Hash support functions for DNA and K-mer types
@@ -12,11 +13,14 @@ PG_FUNCTION_INFO_V1(dna_hash);
 Datum
 dna_hash(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
+    dna *d = PG_GETARG_DNA_PP(0);
     int len = VARSIZE_ANY_EXHDR(d);
     
-    /* Use PostgreSQL's hash_any function */
-    PG_RETURN_UINT32(hash_any((unsigned char *) d->data, len));
+    /*
+     * Hash the header and payload as stored: the representation is
+     * canonical, so packed values hash without being decoded
+     */
+    PG_RETURN_UINT32(hash_any((unsigned char *) VARDATA_ANY(d), len));
 }
 
 /*
@@ -26,12 +30,12 @@ PG_FUNCTION_INFO_V1(dna_hash_extended);
 Datum
 dna_hash_extended(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
+    dna *d = PG_GETARG_DNA_PP(0);
     uint64 seed = PG_GETARG_INT64(1);
     int len = VARSIZE_ANY_EXHDR(d);
     
     /* Use PostgreSQL's hash_any_extended function */
-    PG_RETURN_UINT64(hash_any_extended((unsigned char *) d->data, len, seed));
+    PG_RETURN_UINT64(hash_any_extended((unsigned char *) VARDATA_ANY(d), len, seed));
 }
 
 /*
@@ -41,14 +45,12 @@ PG_FUNCTION_INFO_V1(kmer_hash);
 Datum
 kmer_hash(PG_FUNCTION_ARGS)
 {
-    kmer *k = PG_GETARG_KMER_P(0);
-    uint32 hash_value;
+    kmer k = PG_GETARG_KMER(0);
+    uint32 lohalf = (uint32) k;
+    uint32 hihalf = (uint32) (k >> 32);
     
-    /* Hash both the k value and the sequence data */
-    hash_value = hash_any((unsigned char *) &k->k, sizeof(int32));
-    hash_value ^= hash_any((unsigned char *) k->data, k->k);
-    
-    PG_RETURN_UINT32(hash_value);
+    /* The word already encodes k; fold it like hashint8 does */
+    return hash_uint32(lohalf ^ hihalf);
 }
 
 /*
@@ -58,15 +60,39 @@ PG_FUNCTION_INFO_V1(kmer_hash_extended);
 Datum
 kmer_hash_extended(PG_FUNCTION_ARGS)
 {
-    kmer *k = PG_GETARG_KMER_P(0);
+    kmer k = PG_GETARG_KMER(0);
     uint64 seed = PG_GETARG_INT64(1);
-    uint64 hash_value;
+    uint32 lohalf = (uint32) k;
+    uint32 hihalf = (uint32) (k >> 32);
     
-    /* Hash both the k value and the sequence data with seed */
-    hash_value = hash_any_extended((unsigned char *) &k->k, sizeof(int32), seed);
-    hash_value ^= hash_any_extended((unsigned char *) k->data, k->k, seed);
+    /* The word already encodes k; fold it like hashint8extended does */
+    return hash_uint32_extended(lohalf ^ hihalf, seed);
+}
+
+/*
+ * Hash function of the strand-independent k-mer equality (=~)
+ * Hashes the canonical form, so a k-mer and its reverse complement collide
+ */
+PG_FUNCTION_INFO_V1(kmer_canonical_hash);
+Datum
+kmer_canonical_hash(PG_FUNCTION_ARGS)
+{
+    kmer k = kmer_canonical_word(PG_GETARG_KMER(0));
     
-    PG_RETURN_UINT64(hash_value);
+    return hash_uint32((uint32) k ^ (uint32) (k >> 32));
+}
+
+/*
+ * Extended hash function of the strand-independent k-mer equality
+ */
+PG_FUNCTION_INFO_V1(kmer_canonical_hash_extended);
+Datum
+kmer_canonical_hash_extended(PG_FUNCTION_ARGS)
+{
+    kmer k = kmer_canonical_word(PG_GETARG_KMER(0));
+    uint64 seed = PG_GETARG_INT64(1);
+    
+    return hash_uint32_extended((uint32) k ^ (uint32) (k >> 32), seed);
 }
 
 /*
@@ -77,13 +103,9 @@ Datum
 qkmer_hash(PG_FUNCTION_ARGS)
 {
     qkmer *qk = PG_GETARG_QKMER_P(0);
-    uint32 hash_value;
     
-    /* Hash the k value and both sequence and quality data */
-    hash_value = hash_any((unsigned char *) &qk->k, sizeof(int32));
-    hash_value ^= hash_any((unsigned char *) qk->sequence, qk->k * 2);
-    
-    PG_RETURN_UINT32(hash_value);
+    /* Hash the length, quality encoding, sequence and quality data */
+    PG_RETURN_UINT32(hash_any((unsigned char *) &qk->info, VARSIZE_ANY_EXHDR(qk)));
 }
 
 /*
@@ -95,47 +117,109 @@ qkmer_hash_extended(PG_FUNCTION_ARGS)
 {
     qkmer *qk = PG_GETARG_QKMER_P(0);
     uint64 seed = PG_GETARG_INT64(1);
-    uint64 hash_value;
-    
-    /* Hash the k value and both sequence and quality data with seed */
-    hash_value = hash_any_extended((unsigned char *) &qk->k, sizeof(int32), seed);
-    hash_value ^= hash_any_extended((unsigned char *) qk->sequence, qk->k * 2, seed);
     
-    PG_RETURN_UINT64(hash_value);
+    /* Hash the length, quality encoding, sequence and quality data with seed */
+    PG_RETURN_UINT64(hash_any_extended((unsigned char *) &qk->info,
+                                       VARSIZE_ANY_EXHDR(qk), seed));
+}
+
+/* ntHash seeds of A, C, G and T, in 2-bit code order */
+static const uint64 nthash_seed[4] = {
+    UINT64CONST(0x3c8bfbb395c60474),
+    UINT64CONST(0x3193c18562a02b4c),
+    UINT64CONST(0x20323ed082572324),
+    UINT64CONST(0x295549f54be24456)
+};
+
+static inline uint64
+nthash_rol(uint64 x, int r)
+{
+    r &= 63;
+    return r == 0 ? x : (x << r) | (x >> (64 - r));
+}
+
+static inline uint64
+nthash_ror(uint64 x, int r)
+{
+    return nthash_rol(x, 64 - (r & 63));
 }
 
 /*
- * Rolling hash function for efficient k-mer sliding window
- * Useful for generating k-mers from large sequences
+ * Start hashing the k-mers of a detoasted sequence
  */
-static uint32
-rolling_hash_add_nucleotide(uint32 hash, char nucleotide, int k)
+void
+dna_hash_scan_init(DnaHashScan *scan, const dna *d, int32 k, bool canonical)
 {
-    uint32 base_value = nucleotide_to_int(nucleotide);
-    
-    if (base_value == -1)
-        return hash; /* Invalid nucleotide, return unchanged hash */
-    
-    /* Simple rolling hash: shift left and add new base */
-    return (hash << 2) | base_value;
+    dna_cursor_init(&scan->lead, d);
+    dna_cursor_init(&scan->trail, d);
+    scan->length = d->length;
+    scan->k = k;
+    scan->canonical = canonical;
+    scan->pos = 0;
+    scan->valid = 0;
+    scan->forward = 0;
+    scan->reverse = 0;
 }
 
-static uint32
-rolling_hash_remove_nucleotide(uint32 hash, char nucleotide, int k)
+/*
+ * Hash of the next window made only of A, C, G and T
+ * Returns false when no window is left.
+ */
+bool
+dna_hash_scan_next(DnaHashScan *scan, uint32 *position, uint64 *hash)
 {
-    uint32 base_value = nucleotide_to_int(nucleotide);
-    uint32 mask = (1 << (k * 2)) - 1; /* Mask for k nucleotides */
+    uint32 k = scan->k;
     
-    if (base_value == -1)
-        return hash; /* Invalid nucleotide, return unchanged hash */
+    while (scan->pos < scan->length)
+    {
+        int code = nucleotide_to_int(dna_cursor_base(&scan->lead, scan->pos));
+        
+        scan->pos++;
+        if (code < 0)
+        {
+            scan->valid = 0;
+            continue;
+        }
+        
+        if (scan->valid < k)
+        {
+            /* Grow the window from a reset */
+            if (scan->valid == 0)
+            {
+                scan->forward = 0;
+                scan->reverse = 0;
+            }
+            scan->forward = nthash_rol(scan->forward, 1) ^ nthash_seed[code];
+            scan->reverse ^= nthash_rol(nthash_seed[3 - code], scan->valid);
+            scan->valid++;
+        }
+        else
+        {
+            int out = nucleotide_to_int(dna_cursor_base(&scan->trail, scan->pos - 1 - k));
+            
+            scan->forward = nthash_rol(scan->forward, 1) ^
+                nthash_rol(nthash_seed[out], k) ^ nthash_seed[code];
+            scan->reverse = nthash_ror(scan->reverse, 1) ^
+                nthash_ror(nthash_seed[3 - out], 1) ^
+                nthash_rol(nthash_seed[3 - code], k - 1);
+        }
+        
+        if (scan->valid < k)
+            continue;
+        
+        *position = scan->pos - k;
+        *hash = scan->canonical ? scan->forward + scan->reverse : scan->forward;
+        return true;
+    }
     
-    /* Remove the leftmost nucleotide */
-    return hash & mask;
+    return false;
 }
 
 /*
  * Generate hash values for all k-mers in a DNA sequence
- * Returns an array of hash values
+ * Returns a bigint array with one element per window, NULL for windows
+ * containing ambiguity codes or gaps.  With the optional third argument
+ * set, a k-mer and its reverse complement hash to the same value.
  */
 PG_FUNCTION_INFO_V1(dna_kmer_hashes);
 Datum
@@ -143,48 +227,98 @@ dna_kmer_hashes(PG_FUNCTION_ARGS)
 {
     dna *d = PG_GETARG_DNA_P(0);
     int32 k = PG_GETARG_INT32(1);
-    int seq_len = dna_get_length(d);
-    char *seq = dna_get_str(d);
+    bool canonical = PG_NARGS() > 2 ? PG_GETARG_BOOL(2) : false;
+    DnaHashScan *scan;
     ArrayType *result;
     Datum *elems;
+    bool *nulls;
     int num_kmers;
-    uint32 rolling_hash = 0;
-    int i;
+    int lbound = 1;
+    uint32 position;
+    uint64 hash;
     
-    if (k <= 0 || k > seq_len)
+    if (k <= 0 || (uint32) k > d->length)
         ereport(ERROR,
                 (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                  errmsg("k must be between 1 and sequence length")));
     
-    if (k > 16) /* Limit to prevent overflow in rolling hash */
-        ereport(ERROR,
-                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                 errmsg("k must be <= 16 for rolling hash")));
-    
-    num_kmers = seq_len - k + 1;
+    num_kmers = d->length - k + 1;
     elems = (Datum *) palloc(num_kmers * sizeof(Datum));
+    nulls = (bool *) palloc(num_kmers * sizeof(bool));
+    memset(nulls, true, num_kmers * sizeof(bool));
     
-    /* Initialize rolling hash with first k-mer */
-    for (i = 0; i < k; i++)
+    scan = palloc(sizeof(DnaHashScan));
+    dna_hash_scan_init(scan, d, k, canonical);
+    
+    while (dna_hash_scan_next(scan, &position, &hash))
     {
-        rolling_hash = rolling_hash_add_nucleotide(rolling_hash, seq[i], k);
+        elems[position] = Int64GetDatum((int64) hash);
+        nulls[position] = false;
     }
-    elems[0] = UInt32GetDatum(rolling_hash);
     
-    /* Generate remaining k-mer hashes using rolling hash */
-    for (i = 1; i < num_kmers; i++)
+    result = construct_md_array(elems, nulls, 1, &num_kmers, &lbound,
+                                INT8OID, 8, true, 'd');
+    
+    pfree(scan);
+    pfree(elems);
+    pfree(nulls);
+    
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+/*
+ * Hash values of the k-mers of a DNA sequence as a set
+ * Returns (position, hash) one window per call, skipping windows with
+ * ambiguity codes or gaps, so memory does not grow with the sequence.
+ */
+PG_FUNCTION_INFO_V1(dna_kmer_hashes_srf);
+Datum
+dna_kmer_hashes_srf(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    DnaHashScan *scan;
+    uint32 position;
+    uint64 hash;
+    Datum values[2];
+    bool nulls[2] = {false, false};
+    
+    if (SRF_IS_FIRSTCALL())
     {
-        /* Remove the leftmost nucleotide and add the new rightmost nucleotide */
-        rolling_hash = rolling_hash_remove_nucleotide(rolling_hash, seq[i - 1], k);
-        rolling_hash = rolling_hash_add_nucleotide(rolling_hash, seq[i + k - 1], k);
+        MemoryContext oldcontext;
+        TupleDesc tupdesc;
+        int32 k = PG_GETARG_INT32(1);
         
-        elems[i] = UInt32GetDatum(rolling_hash);
+        if (k <= 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("k must be positive")));
+        
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+        
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("function returning record called in context that cannot accept type record")));
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+        
+        /* The detoasted value must outlive the first call */
+        scan = palloc(sizeof(DnaHashScan));
+        dna_hash_scan_init(scan, PG_GETARG_DNA_P(0), k, PG_GETARG_BOOL(2));
+        funcctx->user_fctx = scan;
+        
+        MemoryContextSwitchTo(oldcontext);
     }
     
-    result = construct_array(elems, num_kmers, INT4OID, 4, true, 'i');
+    funcctx = SRF_PERCALL_SETUP();
+    scan = (DnaHashScan *) funcctx->user_fctx;
     
-    pfree(seq);
-    pfree(elems);
+    if (!dna_hash_scan_next(scan, &position, &hash))
+        SRF_RETURN_DONE(funcctx);
     
-    PG_RETURN_ARRAYTYPE_P(result);
+    values[0] = Int32GetDatum(position);
+    values[1] = Int64GetDatum((int64) hash);
+    
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(funcctx->tuple_desc,
+                                                               values, nulls)));
 }
\ No newline at end of file
@@ -40,4 +40,19 @@ char int_to_nucleotide(int i);
 /* Complement mapping */
 extern const char complement_map[128];
 
+/* Uppercase form of each valid symbol in either case, zero for anything else */
+extern const char nucleotide_normalize_map[256];
+
+/*
+ * Set of bases an uppercase symbol stands for, one bit per base
+ * The gap has a bit of its own, so it is only compatible with itself.
+ */
+#define IUPAC_MASK_A    0x01
+#define IUPAC_MASK_C    0x02
+#define IUPAC_MASK_G    0x04
+#define IUPAC_MASK_T    0x08
+#define IUPAC_MASK_GAP  0x10
+
+extern const uint8 iupac_base_mask[256];
+
 #endif /* IUPAC_H */
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "dna.h"
+#include <string.h>
+#include "funcapi.h"
 
 /*
  * DNA and K-mer operators
@@ -12,10 +14,10 @@ PG_FUNCTION_INFO_V1(dna_eq);
 Datum
 dna_eq(PG_FUNCTION_ARGS)
 {
-    dna *a = PG_GETARG_DNA_P(0);
-    dna *b = PG_GETARG_DNA_P(1);
+    dna *a = PG_GETARG_DNA_PP(0);
+    dna *b = PG_GETARG_DNA_PP(1);
     
-    PG_RETURN_BOOL(dna_compare_internal(a, b) == 0);
+    PG_RETURN_BOOL(dna_equal_internal(a, b));
 }
 
 /*
@@ -25,10 +27,10 @@ PG_FUNCTION_INFO_V1(dna_ne);
 Datum
 dna_ne(PG_FUNCTION_ARGS)
 {
-    dna *a = PG_GETARG_DNA_P(0);
-    dna *b = PG_GETARG_DNA_P(1);
+    dna *a = PG_GETARG_DNA_PP(0);
+    dna *b = PG_GETARG_DNA_PP(1);
     
-    PG_RETURN_BOOL(dna_compare_internal(a, b) != 0);
+    PG_RETURN_BOOL(!dna_equal_internal(a, b));
 }
 
 /*
@@ -96,6 +98,27 @@ dna_cmp(PG_FUNCTION_ARGS)
     PG_RETURN_INT32(dna_compare_internal(a, b));
 }
 
+/*
+ * Position of the first occurrence of needle in haystack, or -1
+ */
+int
+dna_find_internal(const dna *haystack, const dna *needle)
+{
+    DnaView needle_view;
+    DnaSearch search;
+    int result;
+    
+    if (needle->length > haystack->length)
+        return -1;
+    
+    needle_view = dna_get_view(PointerGetDatum(needle));
+    dna_search_init(&search, needle_view.bases, needle_view.length);
+    result = dna_search_first(&search, haystack);
+    dna_release_view(&needle_view);
+    
+    return result;
+}
+
 /*
  * DNA contains operator (@>)
  * Returns true if the left DNA sequence contains the right DNA sequence
@@ -106,16 +129,9 @@ dna_contains(PG_FUNCTION_ARGS)
 {
     dna *haystack = PG_GETARG_DNA_P(0);
     dna *needle = PG_GETARG_DNA_P(1);
-    char *haystack_str = dna_get_str(haystack);
-    char *needle_str = dna_get_str(needle);
-    bool result;
-    
-    result = (strstr(haystack_str, needle_str) != NULL);
+    const DnaSearch *search = dna_search_cached(fcinfo->flinfo, needle);
     
-    pfree(haystack_str);
-    pfree(needle_str);
-    
-    PG_RETURN_BOOL(result);
+    PG_RETURN_BOOL(dna_search_first(search, haystack) >= 0);
 }
 
 /*
@@ -128,53 +144,145 @@ dna_contained_by(PG_FUNCTION_ARGS)
 {
     dna *needle = PG_GETARG_DNA_P(0);
     dna *haystack = PG_GETARG_DNA_P(1);
-    char *haystack_str = dna_get_str(haystack);
-    char *needle_str = dna_get_str(needle);
-    bool result;
-    
-    result = (strstr(haystack_str, needle_str) != NULL);
+    const DnaSearch *search = dna_search_cached(fcinfo->flinfo, needle);
     
-    pfree(haystack_str);
-    pfree(needle_str);
-    
-    PG_RETURN_BOOL(result);
+    PG_RETURN_BOOL(dna_search_first(search, haystack) >= 0);
 }
 
 /*
- * DNA overlap operator (&&)
- * Returns true if two DNA sequences have any common subsequence
+ * Window of the shorter sequence in the overlap hash table
  */
-PG_FUNCTION_INFO_V1(dna_overlap);
-Datum
-dna_overlap(PG_FUNCTION_ARGS)
+typedef struct
 {
-    dna *a = PG_GETARG_DNA_P(0);
-    dna *b = PG_GETARG_DNA_P(1);
-    char *seq_a = dna_get_str(a);
-    char *seq_b = dna_get_str(b);
-    int len_a = dna_get_length(a);
-    int len_b = dna_get_length(b);
+    uint64 hash;        /* Rolling hash of the window */
+    uint32 pos;         /* Window start + 1, or 0 for an empty slot */
+} OverlapSlot;
+
+#define OVERLAP_HASH_BASE       UINT64CONST(0x100000001B3)
+#define OVERLAP_DEFAULT_MIN_LEN 3
+
+/* Slot of a rolling hash in a table of 2^bits slots */
+#define OVERLAP_SLOT(hash, bits) \
+    ((uint32) (((hash) * UINT64CONST(0x9E3779B97F4A7C15)) >> (64 - (bits))))
+
+/*
+ * Check whether two base arrays share a run of at least min_len bases
+ *
+ * Every min_len-base window of the shorter array goes into an open
+ * addressing table keyed by a rolling hash, and the windows of the longer
+ * one are probed against it, so the cost is linear in the total length.
+ * Repeated windows are stored once, which keeps probe chains short on
+ * low-complexity sequence.
+ */
+static bool
+overlap_bases(const char *a, uint32 len_a, const char *b, uint32 len_b,
+              uint32 min_len)
+{
+    const uint8 *small = (const uint8 *) (len_a <= len_b ? a : b);
+    const uint8 *large = (const uint8 *) (len_a <= len_b ? b : a);
+    uint32 small_len = Min(len_a, len_b);
+    uint32 large_len = Max(len_a, len_b);
+    uint64 out_factor = 1;
+    uint64 hash;
+    OverlapSlot *table;
+    uint32 mask;
+    int bits = 4;
     bool result = false;
-    int i, j, k;
+    uint32 i;
+    
+    if (min_len > small_len)
+        return false;
+    
+    while ((UINT64CONST(1) << bits) < 2 * (uint64) (small_len - min_len + 1))
+        bits++;
+    mask = (UINT64CONST(1) << bits) - 1;
+    table = palloc_extended(((Size) mask + 1) * sizeof(OverlapSlot),
+                            MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+    
+    /* Weight of the base leaving the window */
+    for (i = 0; i < min_len; i++)
+        out_factor *= OVERLAP_HASH_BASE;
     
-    /* Check for common subsequences of length >= 3 */
-    for (i = 0; i <= len_a - 3 && !result; i++)
+    hash = 0;
+    for (i = 0; i < small_len; i++)
     {
-        for (j = 0; j <= len_b - 3 && !result; j++)
+        uint32 start;
+        uint32 slot;
+        
+        hash = hash * OVERLAP_HASH_BASE + small[i];
+        if (i >= min_len)
+            hash -= small[i - min_len] * out_factor;
+        if (i + 1 < min_len)
+            continue;
+        
+        start = i + 1 - min_len;
+        for (slot = OVERLAP_SLOT(hash, bits); table[slot].pos != 0; slot = (slot + 1) & mask)
+        {
+            if (table[slot].hash == hash &&
+                memcmp(small + table[slot].pos - 1, small + start, min_len) == 0)
+                break;
+        }
+        if (table[slot].pos == 0)
         {
-            for (k = 3; k <= len_a - i && k <= len_b - j; k++)
+            table[slot].hash = hash;
+            table[slot].pos = start + 1;
+        }
+    }
+    
+    hash = 0;
+    for (i = 0; i < large_len && !result; i++)
+    {
+        uint32 slot;
+        
+        hash = hash * OVERLAP_HASH_BASE + large[i];
+        if (i >= min_len)
+            hash -= large[i - min_len] * out_factor;
+        if (i + 1 < min_len)
+            continue;
+        
+        for (slot = OVERLAP_SLOT(hash, bits); table[slot].pos != 0; slot = (slot + 1) & mask)
+        {
+            if (table[slot].hash == hash &&
+                memcmp(small + table[slot].pos - 1, large + i + 1 - min_len, min_len) == 0)
             {
-                if (memcmp(seq_a + i, seq_b + j, k) == 0)
-                {
-                    result = true;
-                    break;
-                }
+                result = true;
+                break;
             }
         }
     }
     
-    pfree(seq_a);
-    pfree(seq_b);
+    pfree(table);
+    
+    return result;
+}
+
+/*
+ * DNA overlap operator (&&)
+ * Returns true if two DNA sequences share a subsequence of at least 3
+ * bases, or of the length given as third argument
+ */
+PG_FUNCTION_INFO_V1(dna_overlap);
+Datum
+dna_overlap(PG_FUNCTION_ARGS)
+{
+    int32 min_len = PG_NARGS() > 2 ? PG_GETARG_INT32(2) : OVERLAP_DEFAULT_MIN_LEN;
+    DnaView view_a;
+    DnaView view_b;
+    bool result;
+    
+    if (min_len <= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("minimum overlap length must be positive")));
+    
+    view_a = dna_get_view(PG_GETARG_DATUM(0));
+    view_b = dna_get_view(PG_GETARG_DATUM(1));
+    
+    result = overlap_bases(view_a.bases, view_a.length,
+                           view_b.bases, view_b.length, min_len);
+    
+    dna_release_view(&view_a);
+    dna_release_view(&view_b);
     
     PG_RETURN_BOOL(result);
 }
@@ -186,10 +294,10 @@ PG_FUNCTION_INFO_V1(kmer_eq);
 Datum
 kmer_eq(PG_FUNCTION_ARGS)
 {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
+    kmer a = PG_GETARG_KMER(0);
+    kmer b = PG_GETARG_KMER(1);
     
-    PG_RETURN_BOOL(kmer_compare_internal(a, b) == 0);
+    PG_RETURN_BOOL(a == b);
 }
 
 /*
@@ -199,10 +307,10 @@ PG_FUNCTION_INFO_V1(kmer_ne);
 Datum
 kmer_ne(PG_FUNCTION_ARGS)
 {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
+    kmer a = PG_GETARG_KMER(0);
+    kmer b = PG_GETARG_KMER(1);
     
-    PG_RETURN_BOOL(kmer_compare_internal(a, b) != 0);
+    PG_RETURN_BOOL(a != b);
 }
 
 /*
@@ -212,44 +320,266 @@ PG_FUNCTION_INFO_V1(kmer_cmp);
 Datum
 kmer_cmp(PG_FUNCTION_ARGS)
 {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
+    kmer a = PG_GETARG_KMER(0);
+    kmer b = PG_GETARG_KMER(1);
     
     PG_RETURN_INT32(kmer_compare_internal(a, b));
 }
 
+/*
+ * Strand-independent k-mer equality operator (=~)
+ * Returns true if the k-mers are equal or reverse complements of each other
+ */
+PG_FUNCTION_INFO_V1(kmer_canonical_eq);
+Datum
+kmer_canonical_eq(PG_FUNCTION_ARGS)
+{
+    kmer a = PG_GETARG_KMER(0);
+    kmer b = PG_GETARG_KMER(1);
+    
+    PG_RETURN_BOOL(kmer_canonical_word(a) == kmer_canonical_word(b));
+}
+
+/*
+ * Decoded probe kept across calls in fn_extra, like DnaSearchCache
+ */
+typedef struct
+{
+    char *bases;        /* Decoded bases of the probe */
+    char *datum;        /* Copy of the probe the bases were decoded from */
+    Size size;          /* Size of that copy */
+} DnaBasesCache;
+
+/*
+ * Get the decoded bases of a detoasted probe, reusing the cached ones
+ * when the probe has not changed since the previous call
+ */
+static const char *
+dna_bases_cached(FmgrInfo *flinfo, const dna *probe)
+{
+    DnaBasesCache *cache = (DnaBasesCache *) flinfo->fn_extra;
+    Size size = VARSIZE(probe);
+    
+    if (cache != NULL && cache->size == size &&
+        memcmp(cache->datum, probe, size) == 0)
+        return cache->bases;
+    
+    if (cache == NULL)
+    {
+        cache = MemoryContextAllocZero(flinfo->fn_mcxt, sizeof(DnaBasesCache));
+        flinfo->fn_extra = cache;
+    }
+    else
+    {
+        pfree(cache->datum);
+        pfree(cache->bases);
+    }
+    
+    cache->datum = MemoryContextAlloc(flinfo->fn_mcxt, size);
+    memcpy(cache->datum, probe, size);
+    cache->size = size;
+    
+    cache->bases = MemoryContextAlloc(flinfo->fn_mcxt, Max(probe->length, 1));
+    dna_unpack(probe, 0, probe->length, cache->bases);
+    
+    return cache->bases;
+}
+
 /*
  * DNA similarity operator (^@)
- * Returns similarity score between two DNA sequences
+ * Returns 1 - edit distance / longer length, so an indel costs one edit
+ * instead of shifting every following base out of register
  */
 PG_FUNCTION_INFO_V1(dna_similarity);
 Datum
 dna_similarity(PG_FUNCTION_ARGS)
 {
-    dna *a = PG_GETARG_DNA_P(0);
+    DnaView view_a = dna_get_view(PG_GETARG_DATUM(0));
     dna *b = PG_GETARG_DNA_P(1);
-    char *seq_a = dna_get_str(a);
-    char *seq_b = dna_get_str(b);
-    int len_a = dna_get_length(a);
-    int len_b = dna_get_length(b);
-    int matches = 0;
-    int max_len = (len_a > len_b) ? len_a : len_b;
-    int min_len = (len_a < len_b) ? len_a : len_b;
-    double similarity;
-    int i;
+    uint32 max_len = Max(view_a.length, b->length);
+    const char *bases_b;
+    int32 distance;
     
-    /* Count matching positions */
-    for (i = 0; i < min_len; i++)
+    /* The right operand is usually a constant probe: decode it once */
+    bases_b = dna_bases_cached(fcinfo->flinfo, b);
+    
+    distance = dna_edit_distance_bases(view_a.bases, view_a.length,
+                                       bases_b, b->length, -1);
+    
+    dna_release_view(&view_a);
+    
+    if (max_len == 0)
+        PG_RETURN_FLOAT8(0.0);
+    
+    PG_RETURN_FLOAT8(1.0 - (double) distance / max_len);
+}
+
+/*
+ * Edit distance between two DNA sequences
+ * The optional third argument caps the work: once the distance is known to
+ * exceed it, max + 1 is returned
+ */
+PG_FUNCTION_INFO_V1(dna_edit_distance);
+Datum
+dna_edit_distance(PG_FUNCTION_ARGS)
+{
+    DnaView view_a = dna_get_view(PG_GETARG_DATUM(0));
+    DnaView view_b = dna_get_view(PG_GETARG_DATUM(1));
+    int32 max = PG_NARGS() > 2 ? PG_GETARG_INT32(2) : -1;
+    int32 distance;
+    
+    if (PG_NARGS() > 2 && max < 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("maximum distance must not be negative")));
+    
+    distance = dna_edit_distance_bases(view_a.bases, view_a.length,
+                                       view_b.bases, view_b.length, max);
+    
+    dna_release_view(&view_a);
+    dna_release_view(&view_b);
+    
+    PG_RETURN_INT32(distance);
+}
+
+/*
+ * Check whether two DNA sequences are within an edit distance
+ *
+ * Pairs whose lengths, or symbol counts when both values carry a summary,
+ * already differ by too much are rejected from the value prefixes alone.
+ * Otherwise the banded kernel stops as soon as the distance exceeds max.
+ */
+PG_FUNCTION_INFO_V1(dna_within_distance);
+Datum
+dna_within_distance(PG_FUNCTION_ARGS)
+{
+    int32 max = PG_GETARG_INT32(2);
+    DnaSummary summary_a;
+    DnaSummary summary_b;
+    uint32 len_a;
+    uint32 len_b;
+    bool has_a;
+    bool has_b;
+    DnaView view_a;
+    DnaView view_b;
+    int32 distance;
+    
+    if (max < 0)
+        PG_RETURN_BOOL(false);
+    
+    has_a = dna_fetch_summary(PG_GETARG_DATUM(0), &summary_a, &len_a);
+    has_b = dna_fetch_summary(PG_GETARG_DATUM(1), &summary_b, &len_b);
+    
+    if ((len_a > len_b ? len_a - len_b : len_b - len_a) > (uint32) max)
+        PG_RETURN_BOOL(false);
+    
+    if (has_a && has_b)
     {
-        if (seq_a[i] == seq_b[i])
-            matches++;
+        /* An edit changes the symbol counts by at most two in total */
+        uint64 diff = 0;
+        int i;
+        
+        for (i = 0; i < DNA_NSYMBOLS; i++)
+            diff += Abs((int64) summary_a.counts[i] - (int64) summary_b.counts[i]);
+        
+        if ((diff + 1) / 2 > (uint64) max)
+            PG_RETURN_BOOL(false);
     }
     
-    /* Calculate similarity as ratio of matches to maximum length */
-    similarity = (max_len > 0) ? (double)matches / max_len : 0.0;
+    view_a = dna_get_view(PG_GETARG_DATUM(0));
+    view_b = dna_get_view(PG_GETARG_DATUM(1));
     
-    pfree(seq_a);
-    pfree(seq_b);
+    distance = dna_edit_distance_bases(view_a.bases, view_a.length,
+                                       view_b.bases, view_b.length, max);
+    
+    dna_release_view(&view_a);
+    dna_release_view(&view_b);
+    
+    PG_RETURN_BOOL(distance <= max);
+}
+
+/*
+ * Read the scoring arguments of the alignment functions
+ */
+static void
+align_get_scoring(FunctionCallInfo fcinfo, DnaAlignScoring *scoring)
+{
+    scoring->match = PG_GETARG_INT32(2);
+    scoring->mismatch = PG_GETARG_INT32(3);
+    scoring->gap_open = PG_GETARG_INT32(4);
+    scoring->gap_extend = PG_GETARG_INT32(5);
+}
+
+/*
+ * Score of the best local alignment of a query against a target
+ * Skips the work of locating the alignment, for filtering and ranking.
+ */
+PG_FUNCTION_INFO_V1(dna_align_score);
+Datum
+dna_align_score(PG_FUNCTION_ARGS)
+{
+    dna *query = PG_GETARG_DNA_P(0);
+    DnaView target = dna_get_view(PG_GETARG_DATUM(1));
+    DnaAlignScoring scoring;
+    int32 score;
+    
+    align_get_scoring(fcinfo, &scoring);
+    
+    /* The query is usually a constant: its profile is built once */
+    score = dna_align_profile_score(dna_align_cached(fcinfo->flinfo, query, &scoring),
+                                    target.bases, target.length);
+    
+    dna_release_view(&target);
+    
+    PG_RETURN_INT32(score);
+}
+
+/*
+ * Best local alignment of a query against a target
+ * Returns (score, query_start, query_end, target_start, target_end, cigar)
+ * with 0-based coordinates and exclusive ends.  The CIGAR is only computed
+ * when asked for; it and the coordinates are NULL when nothing aligns.
+ */
+PG_FUNCTION_INFO_V1(dna_align_local);
+Datum
+dna_align_local(PG_FUNCTION_ARGS)
+{
+    dna *query = PG_GETARG_DNA_P(0);
+    DnaView target = dna_get_view(PG_GETARG_DATUM(1));
+    bool with_cigar = PG_GETARG_BOOL(6);
+    DnaAlignScoring scoring;
+    DnaAlignment alignment;
+    TupleDesc tupdesc;
+    Datum values[6];
+    bool nulls[6] = {false, false, false, false, false, false};
+    int i;
+    
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("function returning record called in context that cannot accept type record")));
+    tupdesc = BlessTupleDesc(tupdesc);
+    
+    align_get_scoring(fcinfo, &scoring);
+    dna_align_profile_local(dna_align_cached(fcinfo->flinfo, query, &scoring),
+                            target.bases, target.length, with_cigar, &alignment);
+    
+    dna_release_view(&target);
+    
+    values[0] = Int32GetDatum(alignment.score);
+    values[1] = Int32GetDatum(alignment.query_start);
+    values[2] = Int32GetDatum(alignment.query_end);
+    values[3] = Int32GetDatum(alignment.target_start);
+    values[4] = Int32GetDatum(alignment.target_end);
+    if (alignment.score == 0)
+    {
+        for (i = 1; i < 5; i++)
+            nulls[i] = true;
+    }
+    if (alignment.cigar != NULL)
+        values[5] = CStringGetTextDatum(alignment.cigar);
+    else
+        nulls[5] = true;
     
-    PG_RETURN_FLOAT8(similarity);
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
 }
\ No newline at end of file
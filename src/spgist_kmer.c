@@ -41,19 +41,19 @@ spgist_kmer_choose(PG_FUNCTION_ARGS)
 {
     spgChooseIn *in = (spgChooseIn *) PG_GETARG_POINTER(0);
     spgChooseOut *out = (spgChooseOut *) PG_GETARG_POINTER(1);
-    kmer *k = DatumGetKmerP(in->datum);
+    kmer k = DatumGetKmer(in->datum);
     KmerTrieNode *node = (KmerTrieNode *) DatumGetPointer(in->prefixDatum);
     int level = node ? node->level : 0;
     
     /* Check if we've reached the end of the k-mer */
-    if (level >= k->k)
+    if (level >= kmer_get_k(k))
     {
         out->resultType = spgMatchNode;
         PG_RETURN_VOID();
     }
     
     /* Get the nucleotide at the current level */
-    char nucleotide = k->data[level];
+    char nucleotide = kmer_base_at(k, level);
     
     /* Search for matching child node */
     for (int i = 0; i < in->nNodes; i++)
@@ -75,7 +75,7 @@ spgist_kmer_choose(PG_FUNCTION_ARGS)
     KmerTrieNode *new_node = (KmerTrieNode *) palloc(sizeof(KmerTrieNode));
     new_node->level = level + 1;
     new_node->nucleotide = nucleotide;
-    new_node->is_leaf = (level + 1 >= k->k);
+    new_node->is_leaf = (level + 1 >= kmer_get_k(k));
     
     out->result.addNode.nodeN = 0; /* Will be assigned by the system */
     
@@ -101,10 +101,10 @@ spgist_kmer_picksplit(PG_FUNCTION_ARGS)
     
     for (i = 0; i < in->nTuples; i++)
     {
-        kmer *k = DatumGetKmerP(in->datums[i]);
-        if (level < k->k)
+        kmer k = DatumGetKmer(in->datums[i]);
+        if (level < kmer_get_k(k))
         {
-            char nucleotide = k->data[level];
+            char nucleotide = kmer_base_at(k, level);
             switch (nucleotide)
             {
                 case 'A': counts[0]++; break;
@@ -143,8 +143,8 @@ spgist_kmer_picksplit(PG_FUNCTION_ARGS)
     /* Map tuples to nodes */
     for (i = 0; i < in->nTuples; i++)
     {
-        kmer *k = DatumGetKmerP(in->datums[i]);
-        char nucleotide = k->data[level];
+        kmer k = DatumGetKmer(in->datums[i]);
+        char nucleotide = kmer_base_at(k, level);
         
         /* Find which node this tuple belongs to */
         node_index = 0;
@@ -202,11 +202,11 @@ spgist_kmer_inner_consistent(PG_FUNCTION_ARGS)
         
         if (key->sk_strategy == BTEqualStrategyNumber)
         {
-            kmer *query_kmer = DatumGetKmerP(key->sk_argument);
+            kmer query_kmer = DatumGetKmer(key->sk_argument);
             
-            if (level < query_kmer->k)
+            if (level < kmer_get_k(query_kmer))
             {
-                char target_nucleotide = query_kmer->data[level];
+                char target_nucleotide = kmer_base_at(query_kmer, level);
                 
                 /* Find matching child nodes */
                 for (int j = 0; j < in->nNodes; j++)
@@ -236,7 +236,7 @@ spgist_kmer_leaf_consistent(PG_FUNCTION_ARGS)
 {
     spgLeafConsistentIn *in = (spgLeafConsistentIn *) PG_GETARG_POINTER(0);
     spgLeafConsistentOut *out = (spgLeafConsistentOut *) PG_GETARG_POINTER(1);
-    kmer *leaf_kmer = DatumGetKmerP(in->leafDatum);
+    kmer leaf_kmer = DatumGetKmer(in->leafDatum);
     bool match = false;
     
     /* Check each query condition */
@@ -248,31 +248,31 @@ spgist_kmer_leaf_consistent(PG_FUNCTION_ARGS)
         {
             case BTEqualStrategyNumber:
             {
-                kmer *query_kmer = DatumGetKmerP(key->sk_argument);
+                kmer query_kmer = DatumGetKmer(key->sk_argument);
                 match = (kmer_compare_internal(leaf_kmer, query_kmer) == 0);
                 break;
             }
             case BTLessStrategyNumber:
             {
-                kmer *query_kmer = DatumGetKmerP(key->sk_argument);
+                kmer query_kmer = DatumGetKmer(key->sk_argument);
                 match = (kmer_compare_internal(leaf_kmer, query_kmer) < 0);
                 break;
             }
             case BTLessEqualStrategyNumber:
             {
-                kmer *query_kmer = DatumGetKmerP(key->sk_argument);
+                kmer query_kmer = DatumGetKmer(key->sk_argument);
                 match = (kmer_compare_internal(leaf_kmer, query_kmer) <= 0);
                 break;
             }
             case BTGreaterStrategyNumber:
             {
-                kmer *query_kmer = DatumGetKmerP(key->sk_argument);
+                kmer query_kmer = DatumGetKmer(key->sk_argument);
                 match = (kmer_compare_internal(leaf_kmer, query_kmer) > 0);
                 break;
             }
             case BTGreaterEqualStrategyNumber:
             {
-                kmer *query_kmer = DatumGetKmerP(key->sk_argument);
+                kmer query_kmer = DatumGetKmer(key->sk_argument);
                 match = (kmer_compare_internal(leaf_kmer, query_kmer) >= 0);
                 break;
             }
@@ -15,27 +15,19 @@ dna_in(PG_FUNCTION_ARGS)
 {
     char *str = PG_GETARG_CSTRING(0);
     int len = strlen(str);
+    char *bases = palloc(Max(len, 1));
     dna *result;
-    int i;
+    int bad;
     
-    /* Validate input */
-    for (i = 0; i < len; i++)
-    {
-        char c = toupper(str[i]);
-        if (!is_valid_nucleotide(c))
-            ereport(ERROR,
-                    (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                     errmsg("invalid nucleotide character: %c", str[i])));
-    }
-    
-    /* Allocate and populate result */
-    result = (dna *) palloc(VARHDRSZ + len);
-    SET_VARSIZE(result, VARHDRSZ + len);
+    /* Validate and normalize in one pass, then build result */
+    bad = dna_normalize(str, bases, len);
+    if (bad >= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("invalid nucleotide character: %c", str[bad])));
     
-    for (i = 0; i < len; i++)
-    {
-        result->data[i] = toupper(str[i]);
-    }
+    result = dna_make(bases, len);
+    pfree(bases);
     
     PG_RETURN_DNA_P(result);
 }
@@ -47,12 +39,17 @@ PG_FUNCTION_INFO_V1(dna_out);
 Datum
 dna_out(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
-    int len = VARSIZE_ANY_EXHDR(d);
-    char *result = palloc(len + 1);
+    DnaView view = dna_get_view(PG_GETARG_DATUM(0));
+    char *result;
     
-    memcpy(result, d->data, len);
-    result[len] = '\0';
+    /* A decoded buffer can be handed out as is once terminated */
+    if (view.buffer)
+    {
+        result = repalloc(view.buffer, view.length + 1);
+        result[view.length] = '\0';
+    }
+    else
+        result = pnstrdup(view.bases, view.length);
     
     PG_RETURN_CSTRING(result);
 }
@@ -66,6 +63,7 @@ dna_recv(PG_FUNCTION_ARGS)
 {
     StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
     dna *result;
+    char *bases;
     int len;
     
     len = pq_getmsgint(buf, 4);
@@ -74,10 +72,17 @@ dna_recv(PG_FUNCTION_ARGS)
                 (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
                  errmsg("invalid length in DNA binary representation")));
     
-    result = (dna *) palloc(VARHDRSZ + len);
-    SET_VARSIZE(result, VARHDRSZ + len);
+    bases = palloc(Max(len, 1));
+    pq_copymsgbytes(buf, bases, len);
+    
+    /* Binary input gets the same validation as text input */
+    if (dna_normalize(bases, bases, len) >= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                 errmsg("invalid nucleotide character in DNA binary representation")));
     
-    pq_copymsgbytes(buf, result->data, len);
+    result = dna_make(bases, len);
+    pfree(bases);
     
     PG_RETURN_DNA_P(result);
 }
@@ -89,28 +94,62 @@ PG_FUNCTION_INFO_V1(dna_send);
 Datum
 dna_send(PG_FUNCTION_ARGS)
 {
-    dna *d = PG_GETARG_DNA_P(0);
+    DnaView view = dna_get_view(PG_GETARG_DATUM(0));
     StringInfoData buf;
-    int len = VARSIZE_ANY_EXHDR(d);
     
+    /* The wire format is always one byte per base */
     pq_begintypsend(&buf);
-    pq_sendint32(&buf, len);
-    pq_sendbytes(&buf, d->data, len);
+    pq_sendint32(&buf, view.length);
+    pq_sendbytes(&buf, view.bases, view.length);
+    dna_release_view(&view);
     
     PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
+/*
+ * Chunk size used when comparing sequences that must be decoded
+ */
+#define DNA_COMPARE_CHUNK 1024
+
 /*
  * DNA comparison function
+ *
+ * Plain values are compared with memcmp and packed values without
+ * ambiguity runs directly on their packed bytes; anything else is decoded
+ * a chunk at a time.
  */
 int
 dna_compare_internal(const dna *a, const dna *b)
 {
-    int len_a = VARSIZE_ANY_EXHDR(a);
-    int len_b = VARSIZE_ANY_EXHDR(b);
-    int result;
+    uint32 len_a = a->length;
+    uint32 len_b = b->length;
+    uint32 n = Min(len_a, len_b);
+    int result = 0;
     
-    result = memcmp(a->data, b->data, Min(len_a, len_b));
+    if (!DNA_IS_PACKED(a) && !DNA_IS_PACKED(b))
+    {
+        result = memcmp(DNA_BODY(a), DNA_BODY(b), n);
+    }
+    else if (DNA_IS_PACKED(a) && DNA_IS_PACKED(b) &&
+             DNA_NRUNS(a) == 0 && DNA_NRUNS(b) == 0)
+    {
+        result = dna_packed_compare(DNA_PACKED_BITS(a), DNA_PACKED_BITS(b), n);
+    }
+    else
+    {
+        char buf_a[DNA_COMPARE_CHUNK];
+        char buf_b[DNA_COMPARE_CHUNK];
+        uint32 pos;
+        
+        for (pos = 0; pos < n && result == 0; pos += DNA_COMPARE_CHUNK)
+        {
+            uint32 count = Min(n - pos, DNA_COMPARE_CHUNK);
+            
+            dna_unpack(a, pos, count, buf_a);
+            dna_unpack(b, pos, count, buf_b);
+            result = memcmp(buf_a, buf_b, count);
+        }
+    }
     
     if (result != 0)
         return result;
@@ -122,4 +161,22 @@ dna_compare_internal(const dna *a, const dna *b)
         return 1;
     else
         return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * DNA equality function
+ *
+ * The representation of a sequence is canonical, so equal sequences have
+ * identical bytes whether they are plain or packed.  Either argument may
+ * have a short header.
+ */
+bool
+dna_equal_internal(const dna *a, const dna *b)
+{
+    Size len = VARSIZE_ANY_EXHDR(a);
+    
+    if (len != VARSIZE_ANY_EXHDR(b))
+        return false;
+    
+    return memcmp(VARDATA_ANY(a), VARDATA_ANY(b), len) == 0;
+}
@@ -0,0 +1,487 @@
+#include "dna.h"
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+#include "port/pg_bitutils.h"
+
+/*
+ * HyperLogLog type for distinct k-mer counts
+ *
+ * Each canonical ntHash value (see dna_hash_scan_next) is mixed, its top
+ * precision bits pick a register and the position of the first set bit of
+ * the rest raises that register; the cardinality is estimated from the
+ * harmonic mean of the registers, with linear counting for small sets.
+ * K-mers are fed straight from the rolling hash, so counting the distinct
+ * k-mers of a genome needs 2^precision bytes whatever its size; the
+ * standard error is about 1.04 / sqrt(2^precision), 1.6% at the default
+ * precision of 12.
+ */
+
+/*
+ * MurmurHash3 finalizer
+ * ntHash values are not mixed well enough for their bits to be used
+ * directly.
+ */
+static inline uint64
+hll_mix(uint64 h)
+{
+    h ^= h >> 33;
+    h *= UINT64CONST(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64CONST(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    
+    return h;
+}
+
+static void
+hll_check_params(int32 k, int32 precision)
+{
+    if (k <= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("k must be positive")));
+    
+    if (precision < KMER_HLL_MIN_PRECISION || precision > KMER_HLL_MAX_PRECISION)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("precision must be between %d and %d",
+                        KMER_HLL_MIN_PRECISION, KMER_HLL_MAX_PRECISION)));
+}
+
+/*
+ * Empty HyperLogLog in the current memory context
+ */
+static KmerHll *
+hll_create(int32 k, int32 precision)
+{
+    KmerHll *hll = palloc0(KMER_HLL_BYTES(precision));
+    
+    SET_VARSIZE(hll, KMER_HLL_BYTES(precision));
+    hll->k = k;
+    hll->precision = precision;
+    
+    return hll;
+}
+
+static inline void
+hll_add(KmerHll *hll, uint64 hash)
+{
+    int p = hll->precision;
+    uint64 h = hll_mix(hash);
+    uint64 rest = h << p;
+    uint8 rank = rest == 0 ? 64 - p + 1 : 64 - pg_leftmost_one_pos64(rest);
+    uint32 index = (uint32) (h >> (64 - p));
+    
+    if (rank > hll->registers[index])
+        hll->registers[index] = rank;
+}
+
+/*
+ * Add the k-mers of a detoasted sequence
+ * Windows with ambiguity codes or gaps are left out.
+ */
+static void
+hll_add_dna(KmerHll *hll, const dna *d)
+{
+    DnaHashScan *scan = palloc(sizeof(DnaHashScan));
+    uint32 position;
+    uint64 hash;
+    
+    dna_hash_scan_init(scan, d, hll->k, true);
+    while (dna_hash_scan_next(scan, &position, &hash))
+        hll_add(hll, hash);
+    
+    pfree(scan);
+}
+
+/*
+ * Merge the registers of src into dst, which must match it
+ */
+static void
+hll_merge(KmerHll *dst, const KmerHll *src)
+{
+    int32 m = KMER_HLL_REGISTERS(dst->precision);
+    int32 i;
+    
+    if (dst->k != src->k || dst->precision != src->precision)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("cannot combine kmer_hll values with different k or precision")));
+    
+    for (i = 0; i < m; i++)
+        dst->registers[i] = Max(dst->registers[i], src->registers[i]);
+}
+
+static double
+hll_estimate(const KmerHll *hll)
+{
+    int32 m = KMER_HLL_REGISTERS(hll->precision);
+    double sum = 0.0;
+    double alpha;
+    double estimate;
+    int32 zeros = 0;
+    int32 i;
+    
+    for (i = 0; i < m; i++)
+    {
+        sum += ldexp(1.0, -hll->registers[i]);
+        if (hll->registers[i] == 0)
+            zeros++;
+    }
+    
+    if (m == 16)
+        alpha = 0.673;
+    else if (m == 32)
+        alpha = 0.697;
+    else if (m == 64)
+        alpha = 0.709;
+    else
+        alpha = 0.7213 / (1.0 + 1.079 / m);
+    
+    estimate = alpha * m * m / sum;
+    
+    /* Linear counting is more accurate while many registers are empty */
+    if (estimate <= 2.5 * m && zeros > 0)
+        estimate = m * log((double) m / zeros);
+    
+    return estimate;
+}
+
+/*
+ * Check a HyperLogLog read from outside
+ */
+static void
+hll_validate(const KmerHll *hll, int code)
+{
+    int32 m = KMER_HLL_REGISTERS(hll->precision);
+    int32 i;
+    
+    for (i = 0; i < m; i++)
+    {
+        if (hll->registers[i] > 64 - hll->precision + 1)
+            ereport(ERROR,
+                    (errcode(code),
+                     errmsg("invalid kmer_hll register value %d", hll->registers[i])));
+    }
+}
+
+/*
+ * KmerHll input function
+ * Format: "k:precision:registers" with two hexadecimal digits per register
+ */
+PG_FUNCTION_INFO_V1(kmer_hll_in);
+Datum
+kmer_hll_in(PG_FUNCTION_ARGS)
+{
+    char *str = PG_GETARG_CSTRING(0);
+    KmerHll *hll;
+    char *p;
+    char *end;
+    long k;
+    long precision;
+    int32 i;
+    
+    k = strtol(str, &end, 10);
+    if (end == str || *end != ':')
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("kmer_hll format must be k:precision:registers")));
+    p = end + 1;
+    precision = strtol(p, &end, 10);
+    if (end == p || *end != ':')
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("kmer_hll format must be k:precision:registers")));
+    p = end + 1;
+    
+    if (k <= 0 || k > PG_INT32_MAX ||
+        precision < KMER_HLL_MIN_PRECISION || precision > KMER_HLL_MAX_PRECISION)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("invalid kmer_hll header")));
+    
+    if (strlen(p) != 2 * (Size) KMER_HLL_REGISTERS(precision))
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("kmer_hll of precision %ld needs %d registers",
+                        precision, KMER_HLL_REGISTERS(precision))));
+    
+    hll = hll_create(k, precision);
+    for (i = 0; i < KMER_HLL_REGISTERS(precision); i++)
+    {
+        char hex[3] = {p[2 * i], p[2 * i + 1], '\0'};
+        
+        if (!isxdigit((unsigned char) hex[0]) || !isxdigit((unsigned char) hex[1]))
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                     errmsg("invalid register in kmer_hll: \"%s\"", hex)));
+        hll->registers[i] = (uint8) strtol(hex, NULL, 16);
+    }
+    
+    hll_validate(hll, ERRCODE_INVALID_TEXT_REPRESENTATION);
+    
+    PG_RETURN_KMER_HLL_P(hll);
+}
+
+/*
+ * KmerHll output function
+ */
+PG_FUNCTION_INFO_V1(kmer_hll_out);
+Datum
+kmer_hll_out(PG_FUNCTION_ARGS)
+{
+    static const char hexdigits[] = "0123456789abcdef";
+    KmerHll *hll = PG_GETARG_KMER_HLL_P(0);
+    int32 m = KMER_HLL_REGISTERS(hll->precision);
+    StringInfoData buf;
+    int32 i;
+    
+    initStringInfo(&buf);
+    appendStringInfo(&buf, "%d:%d:", hll->k, hll->precision);
+    
+    for (i = 0; i < m; i++)
+    {
+        appendStringInfoChar(&buf, hexdigits[hll->registers[i] >> 4]);
+        appendStringInfoChar(&buf, hexdigits[hll->registers[i] & 0xF]);
+    }
+    
+    PG_RETURN_CSTRING(buf.data);
+}
+
+/*
+ * Read a HyperLogLog in the binary format of kmer_hll_send
+ */
+static KmerHll *
+hll_from_message(StringInfo buf)
+{
+    KmerHll *hll;
+    int32 k;
+    int32 precision;
+    
+    k = pq_getmsgint(buf, 4);
+    precision = pq_getmsgint(buf, 4);
+    
+    if (k <= 0 ||
+        precision < KMER_HLL_MIN_PRECISION || precision > KMER_HLL_MAX_PRECISION)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                 errmsg("invalid kmer_hll header in binary representation")));
+    
+    hll = hll_create(k, precision);
+    pq_copymsgbytes(buf, (char *) hll->registers, KMER_HLL_REGISTERS(precision));
+    hll_validate(hll, ERRCODE_INVALID_BINARY_REPRESENTATION);
+    
+    return hll;
+}
+
+/*
+ * Binary form of a HyperLogLog: k, precision and the registers
+ */
+static bytea *
+hll_to_bytea(const KmerHll *hll)
+{
+    StringInfoData buf;
+    
+    pq_begintypsend(&buf);
+    pq_sendint32(&buf, hll->k);
+    pq_sendint32(&buf, hll->precision);
+    pq_sendbytes(&buf, (const char *) hll->registers,
+                 KMER_HLL_REGISTERS(hll->precision));
+    
+    return pq_endtypsend(&buf);
+}
+
+/*
+ * KmerHll binary receive function
+ */
+PG_FUNCTION_INFO_V1(kmer_hll_recv);
+Datum
+kmer_hll_recv(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_KMER_HLL_P(hll_from_message((StringInfo) PG_GETARG_POINTER(0)));
+}
+
+/*
+ * KmerHll binary send function
+ */
+PG_FUNCTION_INFO_V1(kmer_hll_send);
+Datum
+kmer_hll_send(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BYTEA_P(hll_to_bytea(PG_GETARG_KMER_HLL_P(0)));
+}
+
+/*
+ * HyperLogLog of the k-mers of a DNA sequence
+ */
+PG_FUNCTION_INFO_V1(kmer_hll);
+Datum
+kmer_hll(PG_FUNCTION_ARGS)
+{
+    dna *d = PG_GETARG_DNA_P(0);
+    int32 k = PG_GETARG_INT32(1);
+    int32 precision = PG_GETARG_INT32(2);
+    KmerHll *hll;
+    
+    hll_check_params(k, precision);
+    
+    hll = hll_create(k, precision);
+    hll_add_dna(hll, d);
+    
+    PG_RETURN_KMER_HLL_P(hll);
+}
+
+/*
+ * HyperLogLog of the union of the k-mer sets of two others
+ */
+PG_FUNCTION_INFO_V1(kmer_hll_union);
+Datum
+kmer_hll_union(PG_FUNCTION_ARGS)
+{
+    KmerHll *a = PG_GETARG_KMER_HLL_P(0);
+    KmerHll *b = PG_GETARG_KMER_HLL_P(1);
+    KmerHll *result = palloc(VARSIZE(a));
+    
+    memcpy(result, a, VARSIZE(a));
+    hll_merge(result, b);
+    
+    PG_RETURN_KMER_HLL_P(result);
+}
+
+/*
+ * Estimated number of distinct canonical k-mers
+ */
+PG_FUNCTION_INFO_V1(kmer_hll_cardinality);
+Datum
+kmer_hll_cardinality(PG_FUNCTION_ARGS)
+{
+    KmerHll *hll = PG_GETARG_KMER_HLL_P(0);
+    
+    PG_RETURN_INT64((int64) rint(hll_estimate(hll)));
+}
+
+/*
+ * kmer_hll_agg(dna, k [, precision]) transition function
+ * The state is a KmerHll in the aggregate memory context.
+ */
+PG_FUNCTION_INFO_V1(kmer_hll_agg_trans);
+Datum
+kmer_hll_agg_trans(PG_FUNCTION_ARGS)
+{
+    KmerHll *hll = PG_ARGISNULL(0) ? NULL : (KmerHll *) PG_GETARG_POINTER(0);
+    MemoryContext aggcontext;
+    int32 precision;
+    
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("kmer_hll_agg_trans called in non-aggregate context")));
+    
+    if (PG_ARGISNULL(1) || PG_ARGISNULL(2) || (PG_NARGS() > 3 && PG_ARGISNULL(3)))
+    {
+        if (hll == NULL)
+            PG_RETURN_NULL();
+        PG_RETURN_POINTER(hll);
+    }
+    
+    precision = PG_NARGS() > 3 ? PG_GETARG_INT32(3) : KMER_HLL_DEFAULT_PRECISION;
+    
+    if (hll == NULL)
+    {
+        MemoryContext oldcontext;
+        
+        hll_check_params(PG_GETARG_INT32(2), precision);
+        
+        oldcontext = MemoryContextSwitchTo(aggcontext);
+        hll = hll_create(PG_GETARG_INT32(2), precision);
+        MemoryContextSwitchTo(oldcontext);
+    }
+    else if (hll->k != PG_GETARG_INT32(2) || hll->precision != precision)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("k and precision must be the same for every row of a kmer_hll_agg group")));
+    
+    hll_add_dna(hll, PG_GETARG_DNA_P(1));
+    
+    PG_RETURN_POINTER(hll);
+}
+
+/*
+ * kmer_hll_agg combine function, merging partial parallel states
+ */
+PG_FUNCTION_INFO_V1(kmer_hll_agg_combine);
+Datum
+kmer_hll_agg_combine(PG_FUNCTION_ARGS)
+{
+    KmerHll *state1 = PG_ARGISNULL(0) ? NULL : (KmerHll *) PG_GETARG_POINTER(0);
+    KmerHll *state2 = PG_ARGISNULL(1) ? NULL : (KmerHll *) PG_GETARG_POINTER(1);
+    MemoryContext aggcontext;
+    
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("kmer_hll_agg_combine called in non-aggregate context")));
+    
+    if (state2 == NULL)
+    {
+        if (state1 == NULL)
+            PG_RETURN_NULL();
+        PG_RETURN_POINTER(state1);
+    }
+    
+    if (state1 == NULL)
+    {
+        state1 = MemoryContextAlloc(aggcontext, VARSIZE(state2));
+        memcpy(state1, state2, VARSIZE(state2));
+    }
+    else
+        hll_merge(state1, state2);
+    
+    PG_RETURN_POINTER(state1);
+}
+
+/*
+ * kmer_hll_agg serialization function, in the kmer_hll_send format
+ */
+PG_FUNCTION_INFO_V1(kmer_hll_agg_serialize);
+Datum
+kmer_hll_agg_serialize(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BYTEA_P(hll_to_bytea((KmerHll *) PG_GETARG_POINTER(0)));
+}
+
+/*
+ * kmer_hll_agg deserialization function
+ */
+PG_FUNCTION_INFO_V1(kmer_hll_agg_deserialize);
+Datum
+kmer_hll_agg_deserialize(PG_FUNCTION_ARGS)
+{
+    bytea *state = PG_GETARG_BYTEA_PP(0);
+    StringInfoData buf;
+    KmerHll *hll;
+    
+    initStringInfo(&buf);
+    appendBinaryStringInfo(&buf, VARDATA_ANY(state), VARSIZE_ANY_EXHDR(state));
+    hll = hll_from_message(&buf);
+    pfree(buf.data);
+    
+    PG_RETURN_POINTER(hll);
+}
+
+/*
+ * kmer_hll_agg final function
+ * Returns a copy, as the state may still be used by other final calls.
+ */
+PG_FUNCTION_INFO_V1(kmer_hll_agg_final);
+Datum
+kmer_hll_agg_final(PG_FUNCTION_ARGS)
+{
+    KmerHll *hll = (KmerHll *) PG_GETARG_POINTER(0);
+    KmerHll *result = palloc(VARSIZE(hll));
+    
+    memcpy(result, hll, VARSIZE(hll));
+    
+    PG_RETURN_KMER_HLL_P(result);
+}
@@ -1,11 +1,50 @@
 #include "dna.h"
 #include <string.h>
 #include <ctype.h>
+#include "port/pg_bitutils.h"
+#include "port/pg_bswap.h"
 
 /*
  * K-mer type input/output functions
  */
 
+static const char kmer_bases[4] = { 'A', 'C', 'G', 'T' };
+
+/*
+ * Encode k bases as a k-mer word
+ * Returns false if a base is not one of A, C, G or T (in either case)
+ */
+bool
+kmer_encode(const char *bases, int k, kmer *result)
+{
+    kmer word = 1;
+    int i;
+    
+    for (i = 0; i < k; i++)
+    {
+        int code = nucleotide_to_int(bases[i]);
+        
+        if (code < 0)
+            return false;
+        word = (word << 2) | code;
+    }
+    
+    *result = word;
+    return true;
+}
+
+/*
+ * Check a k-mer length against a kmer(k) type modifier
+ */
+static void
+kmer_check_typmod(int k, int32 typmod)
+{
+    if (typmod >= 0 && k != typmod)
+        ereport(ERROR,
+                (errcode(ERRCODE_STRING_DATA_LENGTH_MISMATCH),
+                 errmsg("k-mer length %d does not match type kmer(%d)", k, typmod)));
+}
+
 /*
  * K-mer input function
  * Format: "ACGT"
@@ -15,36 +54,37 @@ Datum
 kmer_in(PG_FUNCTION_ARGS)
 {
     char *str = PG_GETARG_CSTRING(0);
+    int32 typmod = PG_NARGS() > 2 ? PG_GETARG_INT32(2) : -1;
     int len = strlen(str);
-    kmer *result;
-    int i;
+    char bases[KMER_MAX_K];
+    kmer result;
+    int bad;
     
     if (len == 0)
         ereport(ERROR,
                 (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                  errmsg("k-mer cannot be empty")));
     
-    /* Validate input */
-    for (i = 0; i < len; i++)
-    {
-        char c = toupper(str[i]);
-        if (!is_valid_nucleotide(c))
-            ereport(ERROR,
-                    (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                     errmsg("invalid nucleotide character in k-mer: %c", str[i])));
-    }
+    if (len > KMER_MAX_K)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("k-mer length %d exceeds the maximum of %d", len, KMER_MAX_K)));
     
-    /* Allocate and populate result */
-    result = (kmer *) palloc(VARHDRSZ + sizeof(int32) + len);
-    SET_VARSIZE(result, VARHDRSZ + sizeof(int32) + len);
-    result->k = len;
+    kmer_check_typmod(len, typmod);
     
-    for (i = 0; i < len; i++)
-    {
-        result->data[i] = toupper(str[i]);
-    }
+    /* Validate input */
+    bad = dna_normalize(str, bases, len);
+    if (bad >= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("invalid nucleotide character in k-mer: %c", str[bad])));
+    
+    if (!kmer_encode(bases, len, &result))
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("k-mer cannot contain ambiguity codes or gaps")));
     
-    PG_RETURN_KMER_P(result);
+    PG_RETURN_KMER(result);
 }
 
 /*
@@ -54,13 +94,9 @@ PG_FUNCTION_INFO_V1(kmer_out);
 Datum
 kmer_out(PG_FUNCTION_ARGS)
 {
-    kmer *k = PG_GETARG_KMER_P(0);
-    char *result = palloc(k->k + 1);
+    kmer k = PG_GETARG_KMER(0);
     
-    memcpy(result, k->data, k->k);
-    result[k->k] = '\0';
-    
-    PG_RETURN_CSTRING(result);
+    PG_RETURN_CSTRING(kmer_get_str(k));
 }
 
 /*
@@ -71,80 +107,209 @@ Datum
 kmer_recv(PG_FUNCTION_ARGS)
 {
     StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
-    kmer *result;
+    int32 typmod = PG_NARGS() > 2 ? PG_GETARG_INT32(2) : -1;
+    kmer result;
     int32 k;
     
     k = pq_getmsgint(buf, 4);
-    if (k <= 0)
+    if (k <= 0 || k > KMER_MAX_K)
         ereport(ERROR,
                 (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
                  errmsg("invalid k-mer length in binary representation")));
     
-    result = (kmer *) palloc(VARHDRSZ + sizeof(int32) + k);
-    SET_VARSIZE(result, VARHDRSZ + sizeof(int32) + k);
-    result->k = k;
+    kmer_check_typmod(k, typmod);
     
-    pq_copymsgbytes(buf, result->data, k);
+    if (!kmer_encode(pq_getmsgbytes(buf, k), k, &result))
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                 errmsg("invalid nucleotide character in k-mer binary representation")));
     
-    PG_RETURN_KMER_P(result);
+    PG_RETURN_KMER(result);
 }
 
 /*
  * K-mer binary send function
+ * The wire format is the length followed by one byte per base
  */
 PG_FUNCTION_INFO_V1(kmer_send);
 Datum
 kmer_send(PG_FUNCTION_ARGS)
 {
-    kmer *k = PG_GETARG_KMER_P(0);
+    kmer k = PG_GETARG_KMER(0);
     StringInfoData buf;
+    char *str = kmer_get_str(k);
+    int len = kmer_get_k(k);
     
     pq_begintypsend(&buf);
-    pq_sendint32(&buf, k->k);
-    pq_sendbytes(&buf, k->data, k->k);
+    pq_sendint32(&buf, len);
+    pq_sendbytes(&buf, str, len);
+    pfree(str);
     
     PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
+/*
+ * K-mer type modifier input function
+ * Accepts kmer(k) with k between 1 and KMER_MAX_K
+ */
+PG_FUNCTION_INFO_V1(kmer_typmod_in);
+Datum
+kmer_typmod_in(PG_FUNCTION_ARGS)
+{
+    ArrayType *ta = PG_GETARG_ARRAYTYPE_P(0);
+    int32 *tl;
+    int n;
+    
+    tl = ArrayGetIntegerTypmods(ta, &n);
+    
+    if (n != 1)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("invalid type modifier for kmer")));
+    
+    if (tl[0] < 1 || tl[0] > KMER_MAX_K)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("length for type kmer must be between 1 and %d", KMER_MAX_K)));
+    
+    PG_RETURN_INT32(tl[0]);
+}
+
+/*
+ * K-mer type modifier output function
+ */
+PG_FUNCTION_INFO_V1(kmer_typmod_out);
+Datum
+kmer_typmod_out(PG_FUNCTION_ARGS)
+{
+    int32 typmod = PG_GETARG_INT32(0);
+    
+    if (typmod < 0)
+        PG_RETURN_CSTRING(pstrdup(""));
+    
+    PG_RETURN_CSTRING(psprintf("(%d)", typmod));
+}
+
+/*
+ * Length coercion to kmer(k)
+ *
+ * The length is implied by the word itself, so a kmer(k) column carries no
+ * per-row length and coercion is only a check.
+ */
+PG_FUNCTION_INFO_V1(kmer_enforce_typmod);
+Datum
+kmer_enforce_typmod(PG_FUNCTION_ARGS)
+{
+    kmer k = PG_GETARG_KMER(0);
+    int32 typmod = PG_GETARG_INT32(1);
+    
+    kmer_check_typmod(kmer_get_k(k), typmod);
+    
+    PG_RETURN_KMER(k);
+}
+
 /*
  * Get k-mer as C string
  */
 char *
-kmer_get_str(const kmer *k)
+kmer_get_str(kmer k)
 {
-    char *result = palloc(k->k + 1);
+    int len = kmer_get_k(k);
+    char *result = palloc(len + 1);
+    int i;
     
-    memcpy(result, k->data, k->k);
-    result[k->k] = '\0';
+    for (i = 0; i < len; i++)
+    {
+        result[i] = kmer_bases[(k >> (2 * (len - 1 - i))) & 3];
+    }
+    result[len] = '\0';
     
     return result;
 }
 
 /*
  * Get k-mer length
+ * The sentinel bit sits just above the 2k bits of bases
  */
 int
-kmer_get_k(const kmer *k)
+kmer_get_k(kmer k)
 {
-    return k->k;
+    return pg_leftmost_one_pos64(k) / 2;
+}
+
+/*
+ * Get the base at a position of a k-mer
+ */
+char
+kmer_base_at(kmer k, int pos)
+{
+    int len = kmer_get_k(k);
+    
+    return kmer_bases[(k >> (2 * (len - 1 - pos))) & 3];
+}
+
+/*
+ * Reverse complement of a k-mer word
+ * Complementing a 2-bit code flips both bits; the codes are then reversed
+ * by swapping pairs and nibbles, then bytes, and shifted back in place.
+ */
+kmer
+kmer_revcomp_word(kmer k)
+{
+    int len = kmer_get_k(k);
+    uint64 x = ~k;
+    
+    x = ((x >> 2) & UINT64CONST(0x3333333333333333)) |
+        ((x & UINT64CONST(0x3333333333333333)) << 2);
+    x = ((x >> 4) & UINT64CONST(0x0F0F0F0F0F0F0F0F)) |
+        ((x & UINT64CONST(0x0F0F0F0F0F0F0F0F)) << 4);
+    x = pg_bswap64(x) >> (64 - 2 * len);
+    
+    return x | KMER_SENTINEL(len);
+}
+
+/*
+ * Canonical form of a k-mer word: the lesser of it and its reverse
+ * complement, so both strands of a sequence give the same value
+ */
+kmer
+kmer_canonical_word(kmer k)
+{
+    return Min(k, kmer_revcomp_word(k));
 }
 
 /*
  * K-mer comparison function
+ * Length ordering comes for free from the sentinel bit
  */
 int
-kmer_compare_internal(const kmer *a, const kmer *b)
+kmer_compare_internal(kmer a, kmer b)
 {
-    int result;
-    
-    /* First compare the k values */
-    if (a->k < b->k)
+    if (a < b)
         return -1;
-    else if (a->k > b->k)
+    else if (a > b)
         return 1;
-    
-    /* If k values are equal, compare sequences */
-    result = memcmp(a->data, b->data, a->k);
-    
-    return result;
-}
\ No newline at end of file
+    else
+        return 0;
+}
+
+/*
+ * Reverse complement of a k-mer
+ */
+PG_FUNCTION_INFO_V1(kmer_reverse_complement);
+Datum
+kmer_reverse_complement(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_KMER(kmer_revcomp_word(PG_GETARG_KMER(0)));
+}
+
+/*
+ * Canonical form of a k-mer
+ * Returns the lesser of the k-mer and its reverse complement
+ */
+PG_FUNCTION_INFO_V1(kmer_canonical);
+Datum
+kmer_canonical(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_KMER(kmer_canonical_word(PG_GETARG_KMER(0)));
+}
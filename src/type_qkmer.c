@@ -7,9 +7,168 @@
  * QKmer stores a k-mer with associated quality scores
  */
 
+/*
+ * Quality binning schemes
+ * Each bin covers Phred scores from its lower bound up to the next bound
+ * and is reported as a single representative score.
+ */
+typedef struct
+{
+    int nlevels;            /* Number of bins */
+    int bits;               /* Bits per packed code */
+    const uint8 *lower;     /* Lowest Phred score of each bin */
+    const uint8 *value;     /* Score reported for each bin */
+} QualBinning;
+
+/* Illumina 8-level binning (HiSeq/MiSeq) */
+static const uint8 bin8_lower[8] = { 0, 2, 10, 20, 25, 30, 35, 40 };
+static const uint8 bin8_value[8] = { 0, 6, 15, 22, 27, 33, 37, 40 };
+
+/* Illumina 4-level binning (NovaSeq) */
+static const uint8 bin4_lower[4] = { 0, 3, 18, 30 };
+static const uint8 bin4_value[4] = { 2, 12, 23, 37 };
+
+static const QualBinning qual_binnings[] = {
+    [QKMER_QUAL_BIN8] = { 8, 4, bin8_lower, bin8_value },
+    [QKMER_QUAL_BIN4] = { 4, 2, bin4_lower, bin4_value }
+};
+
+/*
+ * Number of bytes needed for k quality scores in the given mode
+ */
+static int
+qkmer_quality_size(int mode, int k)
+{
+    if (mode == QKMER_QUAL_RAW)
+        return k;
+    
+    return (k * qual_binnings[mode].bits + 7) / 8;
+}
+
+/*
+ * Map a Phred score to its bin
+ */
+static int
+qual_to_code(const QualBinning *b, int q)
+{
+    int code = b->nlevels - 1;
+    
+    while (code > 0 && q < b->lower[code])
+        code--;
+    
+    return code;
+}
+
+/*
+ * Get the code stored for base i of packed binned quality data
+ */
+static inline int
+qual_code_at(const QualBinning *b, const uint8 *codes, int i)
+{
+    int per_byte = 8 / b->bits;
+    int shift = 8 - b->bits * (i % per_byte + 1);
+    
+    return (codes[i / per_byte] >> shift) & ((1 << b->bits) - 1);
+}
+
+/*
+ * Build a qkmer from an uppercase sequence and Phred+33 quality string
+ */
+static qkmer *
+qkmer_build(const char *seq, const char *qual, int k, int mode)
+{
+    int qual_size = qkmer_quality_size(mode, k);
+    int size = VARHDRSZ + sizeof(uint32) + k + qual_size;
+    qkmer *result = (qkmer *) palloc0(size);
+    uint8 *codes = (uint8 *) result->sequence + k;
+    int i;
+    
+    SET_VARSIZE(result, size);
+    result->info = (uint32) k | ((uint32) mode << QKMER_QUAL_SHIFT);
+    memcpy(result->sequence, seq, k);
+    
+    if (mode == QKMER_QUAL_RAW)
+    {
+        memcpy(codes, qual, k);
+    }
+    else
+    {
+        const QualBinning *b = &qual_binnings[mode];
+        int per_byte = 8 / b->bits;
+        int padded = qual_size * per_byte;
+        
+        /* Padding slots get the top code so they never lower the minimum */
+        for (i = 0; i < padded; i++)
+        {
+            int code = (i < k) ? qual_to_code(b, qual[i] - 33) : b->nlevels - 1;
+            
+            codes[i / per_byte] |= code << (8 - b->bits * (i % per_byte + 1));
+        }
+    }
+    
+    return result;
+}
+
+/*
+ * Decode quality scores to Phred+33 characters
+ */
+static void
+qkmer_decode_quality(const qkmer *qk, char *out)
+{
+    int k = QKMER_K(qk);
+    int mode = QKMER_QUAL_MODE(qk);
+    const uint8 *codes = QKMER_QUALITY(qk);
+    int i;
+    
+    if (mode == QKMER_QUAL_RAW)
+    {
+        memcpy(out, codes, k);
+        return;
+    }
+    
+    for (i = 0; i < k; i++)
+    {
+        const QualBinning *b = &qual_binnings[mode];
+        
+        out[i] = b->value[qual_code_at(b, codes, i)] + 33;
+    }
+}
+
+/*
+ * Lowest binned code present in a qkmer
+ * Works a byte at a time; padding slots hold the top code.
+ */
+static int
+qkmer_min_code(const qkmer *qk)
+{
+    const QualBinning *b = &qual_binnings[QKMER_QUAL_MODE(qk)];
+    const uint8 *codes = QKMER_QUALITY(qk);
+    int nbytes = qkmer_quality_size(QKMER_QUAL_MODE(qk), QKMER_K(qk));
+    int per_byte = 8 / b->bits;
+    int mask = (1 << b->bits) - 1;
+    int min_code = b->nlevels - 1;
+    int i, j;
+    
+    for (i = 0; i < nbytes && min_code > 0; i++)
+    {
+        for (j = 0; j < per_byte; j++)
+        {
+            int code = (codes[i] >> (b->bits * j)) & mask;
+            
+            if (code < min_code)
+                min_code = code;
+        }
+    }
+    
+    return min_code;
+}
+
 /*
  * QKmer input function
  * Format: "ACGT:!\"#$" (sequence:quality)
+ *
+ * Quality scores are stored raw, so the same text always gives the same
+ * value; binning is applied only on request, with qkmer_bin_quality().
  */
 PG_FUNCTION_INFO_V1(qkmer_in);
 Datum
@@ -18,8 +177,9 @@ qkmer_in(PG_FUNCTION_ARGS)
     char *str = PG_GETARG_CSTRING(0);
     char *colon_pos = strchr(str, ':');
     qkmer *result;
+    char *seq;
     int seq_len;
-    int i;
+    int bad;
     
     if (!colon_pos)
         ereport(ERROR,
@@ -33,34 +193,26 @@ qkmer_in(PG_FUNCTION_ARGS)
                 (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                  errmsg("qkmer sequence cannot be empty")));
     
+    if (seq_len > QKMER_K_MASK)
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg("qkmer sequence is too long")));
+    
     if (strlen(colon_pos + 1) != seq_len)
         ereport(ERROR,
                 (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                  errmsg("quality string length must match sequence length")));
     
-    /* Validate sequence */
-    for (i = 0; i < seq_len; i++)
-    {
-        char c = toupper(str[i]);
-        if (!is_valid_nucleotide(c))
-            ereport(ERROR,
-                    (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                     errmsg("invalid nucleotide character in qkmer: %c", str[i])));
-    }
-    
-    /* Allocate and populate result */
-    result = (qkmer *) palloc(VARHDRSZ + sizeof(int32) + seq_len * 2);
-    SET_VARSIZE(result, VARHDRSZ + sizeof(int32) + seq_len * 2);
-    result->k = seq_len;
-    
-    /* Copy sequence */
-    for (i = 0; i < seq_len; i++)
-    {
-        result->sequence[i] = toupper(str[i]);
-    }
+    /* Validate and normalize sequence */
+    seq = palloc(seq_len);
+    bad = dna_normalize(str, seq, seq_len);
+    if (bad >= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("invalid nucleotide character in qkmer: %c", str[bad])));
     
-    /* Copy quality scores */
-    memcpy(result->sequence + seq_len, colon_pos + 1, seq_len);
+    result = qkmer_build(seq, colon_pos + 1, seq_len, QKMER_QUAL_RAW);
+    pfree(seq);
     
     PG_RETURN_QKMER_P(result);
 }
@@ -73,18 +225,20 @@ Datum
 qkmer_out(PG_FUNCTION_ARGS)
 {
     qkmer *qk = PG_GETARG_QKMER_P(0);
-    char *result = palloc(qk->k * 2 + 2); /* sequence + ':' + quality + '\0' */
+    int k = QKMER_K(qk);
+    char *result = palloc(k * 2 + 2); /* sequence + ':' + quality + '\0' */
     
-    memcpy(result, qk->sequence, qk->k);
-    result[qk->k] = ':';
-    memcpy(result + qk->k + 1, qk->sequence + qk->k, qk->k);
-    result[qk->k * 2 + 1] = '\0';
+    memcpy(result, qk->sequence, k);
+    result[k] = ':';
+    qkmer_decode_quality(qk, result + k + 1);
+    result[k * 2 + 1] = '\0';
     
     PG_RETURN_CSTRING(result);
 }
 
 /*
  * QKmer binary receive function
+ * The wire format always carries raw quality scores, which are stored raw
  */
 PG_FUNCTION_INFO_V1(qkmer_recv);
 Datum
@@ -92,19 +246,27 @@ qkmer_recv(PG_FUNCTION_ARGS)
 {
     StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
     qkmer *result;
+    const char *data;
+    char *seq;
     int32 k;
     
     k = pq_getmsgint(buf, 4);
-    if (k <= 0)
+    if (k <= 0 || k > QKMER_K_MASK)
         ereport(ERROR,
                 (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
                  errmsg("invalid qkmer length in binary representation")));
     
-    result = (qkmer *) palloc(VARHDRSZ + sizeof(int32) + k * 2);
-    SET_VARSIZE(result, VARHDRSZ + sizeof(int32) + k * 2);
-    result->k = k;
+    data = pq_getmsgbytes(buf, k * 2);
     
-    pq_copymsgbytes(buf, result->sequence, k * 2);
+    /* Binary input gets the same validation as text input */
+    seq = palloc(k);
+    if (dna_normalize(data, seq, k) >= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                 errmsg("invalid nucleotide character in qkmer binary representation")));
+    
+    result = qkmer_build(seq, data + k, k, QKMER_QUAL_RAW);
+    pfree(seq);
     
     PG_RETURN_QKMER_P(result);
 }
@@ -117,15 +279,55 @@ Datum
 qkmer_send(PG_FUNCTION_ARGS)
 {
     qkmer *qk = PG_GETARG_QKMER_P(0);
+    int k = QKMER_K(qk);
     StringInfoData buf;
+    char *qual = palloc(k);
+    
+    qkmer_decode_quality(qk, qual);
     
     pq_begintypsend(&buf);
-    pq_sendint32(&buf, qk->k);
-    pq_sendbytes(&buf, qk->sequence, qk->k * 2);
+    pq_sendint32(&buf, k);
+    pq_sendbytes(&buf, qk->sequence, k);
+    pq_sendbytes(&buf, qual, k);
+    pfree(qual);
     
     PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
+/*
+ * Re-encode the quality scores of a qkmer
+ * Mode is 'off', 'illumina8' or 'illumina4'
+ */
+PG_FUNCTION_INFO_V1(qkmer_bin_quality);
+Datum
+qkmer_bin_quality(PG_FUNCTION_ARGS)
+{
+    qkmer *qk = PG_GETARG_QKMER_P(0);
+    char *mode_name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    int k = QKMER_K(qk);
+    char *qual = palloc(k);
+    qkmer *result;
+    int mode;
+    
+    if (pg_strcasecmp(mode_name, "off") == 0)
+        mode = QKMER_QUAL_RAW;
+    else if (pg_strcasecmp(mode_name, "illumina8") == 0)
+        mode = QKMER_QUAL_BIN8;
+    else if (pg_strcasecmp(mode_name, "illumina4") == 0)
+        mode = QKMER_QUAL_BIN4;
+    else
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("unknown quality binning \"%s\"", mode_name),
+                 errhint("Valid values are \"off\", \"illumina8\" and \"illumina4\".")));
+    
+    qkmer_decode_quality(qk, qual);
+    result = qkmer_build(qk->sequence, qual, k, mode);
+    pfree(qual);
+    
+    PG_RETURN_QKMER_P(result);
+}
+
 /*
  * Get average quality score for a qkmer
  */
@@ -134,16 +336,44 @@ Datum
 qkmer_avg_quality(PG_FUNCTION_ARGS)
 {
     qkmer *qk = PG_GETARG_QKMER_P(0);
+    int k = QKMER_K(qk);
+    int mode = QKMER_QUAL_MODE(qk);
+    const uint8 *codes = QKMER_QUALITY(qk);
     double sum = 0.0;
     int i;
     
-    for (i = 0; i < qk->k; i++)
+    if (mode == QKMER_QUAL_RAW)
+    {
+        for (i = 0; i < k; i++)
+        {
+            /* Convert Phred quality to numeric (assuming Phred+33 encoding) */
+            sum += (double)(codes[i] - 33);
+        }
+    }
+    else
     {
-        /* Convert Phred quality to numeric (assuming Phred+33 encoding) */
-        sum += (double)(qk->sequence[qk->k + i] - 33);
+        /* Histogram the packed codes, then weight each bin by its score */
+        const QualBinning *b = &qual_binnings[mode];
+        int nbytes = qkmer_quality_size(mode, k);
+        int per_byte = 8 / b->bits;
+        int mask = (1 << b->bits) - 1;
+        int counts[8] = {0};
+        int j;
+        
+        for (i = 0; i < nbytes; i++)
+        {
+            for (j = 0; j < per_byte; j++)
+                counts[(codes[i] >> (b->bits * j)) & mask]++;
+        }
+        
+        /* Padding slots hold the top code */
+        counts[b->nlevels - 1] -= nbytes * per_byte - k;
+        
+        for (i = 0; i < b->nlevels; i++)
+            sum += (double) counts[i] * b->value[i];
     }
     
-    PG_RETURN_FLOAT8(sum / qk->k);
+    PG_RETURN_FLOAT8(sum / k);
 }
 
 /*
@@ -154,12 +384,20 @@ Datum
 qkmer_min_quality(PG_FUNCTION_ARGS)
 {
     qkmer *qk = PG_GETARG_QKMER_P(0);
-    int min_qual = qk->sequence[qk->k] - 33;
+    int k = QKMER_K(qk);
+    int mode = QKMER_QUAL_MODE(qk);
+    const uint8 *codes = QKMER_QUALITY(qk);
+    int min_qual;
     int i;
     
-    for (i = 1; i < qk->k; i++)
+    /* Bin scores increase with the code, so the lowest code gives the minimum */
+    if (mode != QKMER_QUAL_RAW)
+        PG_RETURN_INT32(qual_binnings[mode].value[qkmer_min_code(qk)]);
+    
+    min_qual = codes[0] - 33;
+    for (i = 1; i < k; i++)
     {
-        int qual = qk->sequence[qk->k + i] - 33;
+        int qual = codes[i] - 33;
         if (qual < min_qual)
             min_qual = qual;
     }
@@ -176,14 +414,24 @@ qkmer_filter_quality(PG_FUNCTION_ARGS)
 {
     qkmer *qk = PG_GETARG_QKMER_P(0);
     int min_threshold = PG_GETARG_INT32(1);
+    int k = QKMER_K(qk);
+    int mode = QKMER_QUAL_MODE(qk);
+    const uint8 *codes = QKMER_QUALITY(qk);
     int i;
     
-    for (i = 0; i < qk->k; i++)
+    if (mode != QKMER_QUAL_RAW)
     {
-        int qual = qk->sequence[qk->k + i] - 33;
+        const QualBinning *b = &qual_binnings[mode];
+        
+        PG_RETURN_BOOL(b->value[qkmer_min_code(qk)] >= min_threshold);
+    }
+    
+    for (i = 0; i < k; i++)
+    {
+        int qual = codes[i] - 33;
         if (qual < min_threshold)
             PG_RETURN_BOOL(false);
     }
     
     PG_RETURN_BOOL(true);
-}
\ No newline at end of file
+}
@@ -0,0 +1,650 @@
+#include "dna.h"
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+
+/*
+ * MinHash sketch type
+ *
+ * A dna_sketch keeps the s smallest distinct canonical ntHash values of
+ * the k-mers it was built from (see dna_hash_scan_next), so a sequence and
+ * its reverse complement give the same sketch.  As in Mash, the Jaccard
+ * index of two k-mer sets is estimated from the s smallest hashes of the
+ * union of their sketches, which is a single merge of two sorted arrays.
+ *
+ * A builder buffers up to 2 s candidate hashes, accepting only those not
+ * above the largest of the s kept at the last compaction, then sorts and
+ * truncates the buffer back to s when it fills.  Past the first few
+ * thousand k-mers almost every hash is rejected by one comparison.
+ */
+
+typedef struct
+{
+    int32 k;
+    int32 size;         /* s, the most hashes kept */
+    int32 count;        /* Hashes in the buffer */
+    int32 capacity;     /* Buffer length */
+    uint64 threshold;   /* Largest hash that may still be kept */
+    uint64 *hashes;     /* Candidates, in no particular order */
+} SketchBuilder;
+
+static int
+sketch_hash_cmp(const void *a, const void *b)
+{
+    uint64 x = *(const uint64 *) a;
+    uint64 y = *(const uint64 *) b;
+    
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Sort hashes in place and drop duplicates, keeping at most limit
+ * Returns the number kept.
+ */
+static int32
+sketch_sort_unique(uint64 *hashes, int32 count, int32 limit)
+{
+    int32 n = 0;
+    int32 i;
+    
+    qsort(hashes, count, sizeof(uint64), sketch_hash_cmp);
+    
+    for (i = 0; i < count && n < limit; i++)
+    {
+        if (n == 0 || hashes[i] != hashes[n - 1])
+            hashes[n++] = hashes[i];
+    }
+    
+    return n;
+}
+
+static void
+sketch_check_params(int32 k, int32 size)
+{
+    if (k <= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("k must be positive")));
+    
+    if (size <= 0 || size > DNA_SKETCH_MAX_SIZE)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("sketch size must be between 1 and %d", DNA_SKETCH_MAX_SIZE)));
+}
+
+/*
+ * Set up a builder in the current memory context
+ */
+static SketchBuilder *
+sketch_builder_create(int32 k, int32 size)
+{
+    SketchBuilder *builder = palloc(sizeof(SketchBuilder));
+    
+    builder->k = k;
+    builder->size = size;
+    builder->count = 0;
+    builder->capacity = 2 * size;
+    builder->threshold = PG_UINT64_MAX;
+    builder->hashes = palloc(builder->capacity * sizeof(uint64));
+    
+    return builder;
+}
+
+/*
+ * Reduce the buffer to the s smallest distinct hashes
+ */
+static void
+sketch_builder_compact(SketchBuilder *builder)
+{
+    builder->count = sketch_sort_unique(builder->hashes, builder->count,
+                                        builder->size);
+    if (builder->count == builder->size)
+        builder->threshold = builder->hashes[builder->size - 1];
+}
+
+static inline void
+sketch_builder_add(SketchBuilder *builder, uint64 hash)
+{
+    if (hash > builder->threshold)
+        return;
+    
+    if (builder->count == builder->capacity)
+    {
+        sketch_builder_compact(builder);
+        if (hash > builder->threshold)
+            return;
+    }
+    
+    builder->hashes[builder->count++] = hash;
+}
+
+/*
+ * Add the k-mers of a detoasted sequence
+ */
+static void
+sketch_builder_add_dna(SketchBuilder *builder, const dna *d)
+{
+    DnaHashScan *scan = palloc(sizeof(DnaHashScan));
+    uint32 position;
+    uint64 hash;
+    
+    dna_hash_scan_init(scan, d, builder->k, true);
+    while (dna_hash_scan_next(scan, &position, &hash))
+        sketch_builder_add(builder, hash);
+    
+    pfree(scan);
+}
+
+/*
+ * Build a sketch from the hashes of a builder, which is left unchanged
+ */
+static DnaSketch *
+sketch_builder_finish(const SketchBuilder *builder)
+{
+    DnaSketch *sketch = palloc(DNA_SKETCH_BYTES(builder->count));
+    int32 count;
+    
+    memcpy(sketch->hashes, builder->hashes, builder->count * sizeof(uint64));
+    count = sketch_sort_unique(sketch->hashes, builder->count, builder->size);
+    
+    SET_VARSIZE(sketch, DNA_SKETCH_BYTES(count));
+    sketch->k = builder->k;
+    sketch->size = builder->size;
+    sketch->count = count;
+    
+    return sketch;
+}
+
+/*
+ * Check the header and hashes of a sketch read from outside
+ */
+static void
+sketch_validate(const DnaSketch *sketch, int code)
+{
+    int32 i;
+    
+    if (sketch->k <= 0 || sketch->size <= 0 ||
+        sketch->size > DNA_SKETCH_MAX_SIZE || sketch->count > sketch->size)
+        ereport(ERROR,
+                (errcode(code),
+                 errmsg("invalid dna_sketch header")));
+    
+    for (i = 1; i < sketch->count; i++)
+    {
+        if (sketch->hashes[i] <= sketch->hashes[i - 1])
+            ereport(ERROR,
+                    (errcode(code),
+                     errmsg("dna_sketch hashes must be distinct and in ascending order")));
+    }
+}
+
+/*
+ * DnaSketch input function
+ * Format: "k:s:hash,hash,..." with hashes as 16 hexadecimal digits
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_in);
+Datum
+dna_sketch_in(PG_FUNCTION_ARGS)
+{
+    char *str = PG_GETARG_CSTRING(0);
+    DnaSketch *sketch;
+    char *p;
+    char *end;
+    long k;
+    long size;
+    int32 count = 0;
+    
+    k = strtol(str, &end, 10);
+    if (end == str || *end != ':')
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("dna_sketch format must be k:s:hashes")));
+    p = end + 1;
+    size = strtol(p, &end, 10);
+    if (end == p || *end != ':')
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("dna_sketch format must be k:s:hashes")));
+    p = end + 1;
+    
+    if (k <= 0 || k > PG_INT32_MAX || size <= 0 || size > DNA_SKETCH_MAX_SIZE)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("invalid dna_sketch header")));
+    
+    sketch = palloc(DNA_SKETCH_BYTES(size));
+    sketch->k = k;
+    sketch->size = size;
+    
+    while (*p != '\0')
+    {
+        if (count == size)
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                     errmsg("dna_sketch holds more than %ld hashes", size)));
+        
+        errno = 0;
+        sketch->hashes[count++] = strtou64(p, &end, 16);
+        if (!isxdigit((unsigned char) *p) || errno != 0 ||
+            (*end != ',' && *end != '\0'))
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                     errmsg("invalid hash in dna_sketch: \"%s\"", p)));
+        p = *end == ',' ? end + 1 : end;
+    }
+    
+    sketch->count = count;
+    SET_VARSIZE(sketch, DNA_SKETCH_BYTES(count));
+    sketch_validate(sketch, ERRCODE_INVALID_TEXT_REPRESENTATION);
+    
+    PG_RETURN_DNA_SKETCH_P(sketch);
+}
+
+/*
+ * DnaSketch output function
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_out);
+Datum
+dna_sketch_out(PG_FUNCTION_ARGS)
+{
+    DnaSketch *sketch = PG_GETARG_DNA_SKETCH_P(0);
+    StringInfoData buf;
+    int32 i;
+    
+    initStringInfo(&buf);
+    appendStringInfo(&buf, "%d:%d:", sketch->k, sketch->size);
+    
+    for (i = 0; i < sketch->count; i++)
+        appendStringInfo(&buf, i == 0 ? "%016" INT64_MODIFIER "x" : ",%016" INT64_MODIFIER "x",
+                         sketch->hashes[i]);
+    
+    PG_RETURN_CSTRING(buf.data);
+}
+
+/*
+ * DnaSketch binary receive function
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_recv);
+Datum
+dna_sketch_recv(PG_FUNCTION_ARGS)
+{
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    DnaSketch *sketch;
+    int32 k;
+    int32 size;
+    int32 count;
+    int32 i;
+    
+    k = pq_getmsgint(buf, 4);
+    size = pq_getmsgint(buf, 4);
+    count = pq_getmsgint(buf, 4);
+    
+    if (k <= 0 || size <= 0 || size > DNA_SKETCH_MAX_SIZE ||
+        count < 0 || count > size)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                 errmsg("invalid dna_sketch header in binary representation")));
+    
+    sketch = palloc(DNA_SKETCH_BYTES(count));
+    SET_VARSIZE(sketch, DNA_SKETCH_BYTES(count));
+    sketch->k = k;
+    sketch->size = size;
+    sketch->count = count;
+    for (i = 0; i < count; i++)
+        sketch->hashes[i] = (uint64) pq_getmsgint64(buf);
+    
+    sketch_validate(sketch, ERRCODE_INVALID_BINARY_REPRESENTATION);
+    
+    PG_RETURN_DNA_SKETCH_P(sketch);
+}
+
+/*
+ * Binary form of a sketch: k, s, the number of hashes and the hashes
+ */
+static bytea *
+sketch_to_bytea(const DnaSketch *sketch)
+{
+    StringInfoData buf;
+    int32 i;
+    
+    pq_begintypsend(&buf);
+    pq_sendint32(&buf, sketch->k);
+    pq_sendint32(&buf, sketch->size);
+    pq_sendint32(&buf, sketch->count);
+    for (i = 0; i < sketch->count; i++)
+        pq_sendint64(&buf, sketch->hashes[i]);
+    
+    return pq_endtypsend(&buf);
+}
+
+/*
+ * DnaSketch binary send function
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_send);
+Datum
+dna_sketch_send(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BYTEA_P(sketch_to_bytea(PG_GETARG_DNA_SKETCH_P(0)));
+}
+
+/*
+ * Sketch of the k-mers of a DNA sequence
+ * Windows with ambiguity codes or gaps are left out.
+ */
+PG_FUNCTION_INFO_V1(dna_sketch);
+Datum
+dna_sketch(PG_FUNCTION_ARGS)
+{
+    dna *d = PG_GETARG_DNA_P(0);
+    int32 k = PG_GETARG_INT32(1);
+    int32 size = PG_GETARG_INT32(2);
+    SketchBuilder *builder;
+    
+    sketch_check_params(k, size);
+    
+    builder = sketch_builder_create(k, size);
+    sketch_builder_add_dna(builder, d);
+    
+    PG_RETURN_DNA_SKETCH_P(sketch_builder_finish(builder));
+}
+
+static void
+sketch_check_compatible(const DnaSketch *a, const DnaSketch *b)
+{
+    if (a->k != b->k)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("cannot combine sketches of %d-mers and %d-mers", a->k, b->k)));
+}
+
+/*
+ * Sketch of the union of the k-mer sets of two sketches
+ * The result keeps the smaller of the two sizes.
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_union);
+Datum
+dna_sketch_union(PG_FUNCTION_ARGS)
+{
+    DnaSketch *a = PG_GETARG_DNA_SKETCH_P(0);
+    DnaSketch *b = PG_GETARG_DNA_SKETCH_P(1);
+    int32 size = Min(a->size, b->size);
+    DnaSketch *result;
+    int32 i = 0;
+    int32 j = 0;
+    int32 n = 0;
+    
+    sketch_check_compatible(a, b);
+    
+    result = palloc(DNA_SKETCH_BYTES(size));
+    while (n < size && (i < a->count || j < b->count))
+    {
+        if (j == b->count || (i < a->count && a->hashes[i] < b->hashes[j]))
+            result->hashes[n++] = a->hashes[i++];
+        else
+        {
+            if (i < a->count && a->hashes[i] == b->hashes[j])
+                i++;
+            result->hashes[n++] = b->hashes[j++];
+        }
+    }
+    
+    SET_VARSIZE(result, DNA_SKETCH_BYTES(n));
+    result->k = a->k;
+    result->size = size;
+    result->count = n;
+    
+    PG_RETURN_DNA_SKETCH_P(result);
+}
+
+/*
+ * dna_sketch_agg(dna, k, s) transition function
+ * The state is a builder in the aggregate memory context.
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_agg_trans);
+Datum
+dna_sketch_agg_trans(PG_FUNCTION_ARGS)
+{
+    SketchBuilder *builder = PG_ARGISNULL(0) ? NULL : (SketchBuilder *) PG_GETARG_POINTER(0);
+    MemoryContext aggcontext;
+    
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("dna_sketch_agg_trans called in non-aggregate context")));
+    
+    if (PG_ARGISNULL(1) || PG_ARGISNULL(2) || PG_ARGISNULL(3))
+    {
+        if (builder == NULL)
+            PG_RETURN_NULL();
+        PG_RETURN_POINTER(builder);
+    }
+    
+    if (builder == NULL)
+    {
+        MemoryContext oldcontext;
+        
+        sketch_check_params(PG_GETARG_INT32(2), PG_GETARG_INT32(3));
+        
+        oldcontext = MemoryContextSwitchTo(aggcontext);
+        builder = sketch_builder_create(PG_GETARG_INT32(2), PG_GETARG_INT32(3));
+        MemoryContextSwitchTo(oldcontext);
+    }
+    else if (builder->k != PG_GETARG_INT32(2) || builder->size != PG_GETARG_INT32(3))
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("k and s must be the same for every row of a dna_sketch_agg group")));
+    
+    sketch_builder_add_dna(builder, PG_GETARG_DNA_P(1));
+    
+    PG_RETURN_POINTER(builder);
+}
+
+/*
+ * dna_sketch_agg combine function, merging partial parallel states
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_agg_combine);
+Datum
+dna_sketch_agg_combine(PG_FUNCTION_ARGS)
+{
+    SketchBuilder *state1 = PG_ARGISNULL(0) ? NULL : (SketchBuilder *) PG_GETARG_POINTER(0);
+    SketchBuilder *state2 = PG_ARGISNULL(1) ? NULL : (SketchBuilder *) PG_GETARG_POINTER(1);
+    MemoryContext aggcontext;
+    int32 i;
+    
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("dna_sketch_agg_combine called in non-aggregate context")));
+    
+    if (state2 == NULL)
+    {
+        if (state1 == NULL)
+            PG_RETURN_NULL();
+        PG_RETURN_POINTER(state1);
+    }
+    
+    if (state1 == NULL)
+    {
+        MemoryContext oldcontext = MemoryContextSwitchTo(aggcontext);
+        
+        state1 = sketch_builder_create(state2->k, state2->size);
+        MemoryContextSwitchTo(oldcontext);
+    }
+    else if (state1->k != state2->k || state1->size != state2->size)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("k and s must be the same for every row of a dna_sketch_agg group")));
+    
+    for (i = 0; i < state2->count; i++)
+        sketch_builder_add(state1, state2->hashes[i]);
+    
+    PG_RETURN_POINTER(state1);
+}
+
+/*
+ * dna_sketch_agg serialization function
+ * The state is sent as the sketch it stands for, in the dna_sketch_send
+ * format.
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_agg_serialize);
+Datum
+dna_sketch_agg_serialize(PG_FUNCTION_ARGS)
+{
+    DnaSketch *sketch = sketch_builder_finish((SketchBuilder *) PG_GETARG_POINTER(0));
+    bytea *result = sketch_to_bytea(sketch);
+    
+    pfree(sketch);
+    
+    PG_RETURN_BYTEA_P(result);
+}
+
+/*
+ * dna_sketch_agg deserialization function
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_agg_deserialize);
+Datum
+dna_sketch_agg_deserialize(PG_FUNCTION_ARGS)
+{
+    bytea *state = PG_GETARG_BYTEA_PP(0);
+    SketchBuilder *builder;
+    StringInfoData buf;
+    int32 k;
+    int32 size;
+    int32 count;
+    int32 i;
+    
+    initStringInfo(&buf);
+    appendBinaryStringInfo(&buf, VARDATA_ANY(state), VARSIZE_ANY_EXHDR(state));
+    
+    k = pq_getmsgint(&buf, 4);
+    size = pq_getmsgint(&buf, 4);
+    count = pq_getmsgint(&buf, 4);
+    
+    builder = sketch_builder_create(k, size);
+    for (i = 0; i < count; i++)
+        builder->hashes[i] = (uint64) pq_getmsgint64(&buf);
+    builder->count = count;
+    if (count == size)
+        builder->threshold = builder->hashes[count - 1];
+    
+    pfree(buf.data);
+    
+    PG_RETURN_POINTER(builder);
+}
+
+/*
+ * dna_sketch_agg final function
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_agg_final);
+Datum
+dna_sketch_agg_final(PG_FUNCTION_ARGS)
+{
+    SketchBuilder *builder = (SketchBuilder *) PG_GETARG_POINTER(0);
+    
+    PG_RETURN_DNA_SKETCH_P(sketch_builder_finish(builder));
+}
+
+/*
+ * Jaccard index of the k-mer sets of two sketches
+ * Of the s smallest hashes of the union of both sketches, s being the
+ * smaller size, the fraction found in both.
+ */
+static double
+sketch_jaccard(const DnaSketch *a, const DnaSketch *b)
+{
+    int32 size = Min(a->size, b->size);
+    int32 i = 0;
+    int32 j = 0;
+    int32 seen = 0;
+    int32 shared = 0;
+    
+    while (seen < size && (i < a->count || j < b->count))
+    {
+        if (j == b->count || (i < a->count && a->hashes[i] < b->hashes[j]))
+            i++;
+        else if (i == a->count || b->hashes[j] < a->hashes[i])
+            j++;
+        else
+        {
+            shared++;
+            i++;
+            j++;
+        }
+        seen++;
+    }
+    
+    return seen > 0 ? (double) shared / seen : 0.0;
+}
+
+/*
+ * Estimated Jaccard index of two sketches
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_jaccard);
+Datum
+dna_sketch_jaccard(PG_FUNCTION_ARGS)
+{
+    DnaSketch *a = PG_GETARG_DNA_SKETCH_P(0);
+    DnaSketch *b = PG_GETARG_DNA_SKETCH_P(1);
+    
+    sketch_check_compatible(a, b);
+    
+    PG_RETURN_FLOAT8(sketch_jaccard(a, b));
+}
+
+/*
+ * Estimated fraction of the k-mers of the first sketch found in the second
+ * Only hashes up to the largest one both sketches can hold are compared.
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_containment);
+Datum
+dna_sketch_containment(PG_FUNCTION_ARGS)
+{
+    DnaSketch *a = PG_GETARG_DNA_SKETCH_P(0);
+    DnaSketch *b = PG_GETARG_DNA_SKETCH_P(1);
+    uint64 limit = PG_UINT64_MAX;
+    int32 i = 0;
+    int32 j = 0;
+    int32 total = 0;
+    int32 shared = 0;
+    
+    sketch_check_compatible(a, b);
+    
+    /* A full sketch says nothing of the hashes above its largest one */
+    if (a->count > 0 && a->count == a->size)
+        limit = a->hashes[a->count - 1];
+    if (b->count > 0 && b->count == b->size)
+        limit = Min(limit, b->hashes[b->count - 1]);
+    
+    for (i = 0; i < a->count && a->hashes[i] <= limit; i++)
+    {
+        while (j < b->count && b->hashes[j] < a->hashes[i])
+            j++;
+        if (j < b->count && b->hashes[j] == a->hashes[i])
+            shared++;
+        total++;
+    }
+    
+    PG_RETURN_FLOAT8(total > 0 ? (double) shared / total : 0.0);
+}
+
+/*
+ * Mash distance of two sketches (<->)
+ * -ln(2j / (1 + j)) / k for a Jaccard index j, an estimate of the
+ * per-base divergence of the sequences; 1 when no k-mer is shared.
+ */
+PG_FUNCTION_INFO_V1(dna_sketch_distance);
+Datum
+dna_sketch_distance(PG_FUNCTION_ARGS)
+{
+    DnaSketch *a = PG_GETARG_DNA_SKETCH_P(0);
+    DnaSketch *b = PG_GETARG_DNA_SKETCH_P(1);
+    double j;
+    
+    sketch_check_compatible(a, b);
+    
+    j = sketch_jaccard(a, b);
+    if (j <= 0.0)
+        PG_RETURN_FLOAT8(1.0);
+    
+    PG_RETURN_FLOAT8(Min(1.0, -log(2.0 * j / (1.0 + j)) / a->k));
+}